@@ -0,0 +1,566 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * Measures the hot paths of MyTree / DirectoryTree on synthetic directory trees.
+ * Usage: treebenchmark [leaf count]...
+ * Without arguments trees with 10k, 100k and 1M leafs are generated. Every size is run for a
+ * wide and a deep tree shape, once allocating from the heap and once from a TreeArena. Each
+ * of these runs in a separate process.
+ * Memory figures are for that process, "bytes/leaf" is the growth of the process while
+ * building the tree divided by the number of leafs. The fixed size of a leaf is printed
+ * first, the rest of that figure is what the names and the tree structure allocate.
+ *
+ * To get figures for comparison from a tree that predates the arena, the name keyed lookups
+ * and CowTree, check out the src directory of that version and configure with
+ * BENCHMARK_BASELINE=ON. This defines TREEBENCHMARK_BASELINE, which limits the benchmark to
+ * the API that the original std::set<Node*> tree provides and skips the arena runs.
+ */
+
+#include "directorytree.h"
+
+#include <QElapsedTimer>
+#include <QProcess>
+#include <QString>
+#include <QStringList>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <fstream>
+#include <string>
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <vector>
+
+using namespace MOBase;
+
+
+namespace {
+
+struct MemoryUsage {
+  qint64 current;
+  qint64 peak;
+};
+
+#ifdef _WIN32
+
+MemoryUsage memoryUsage()
+{
+  PROCESS_MEMORY_COUNTERS_EX counters;
+  if (!::GetProcessMemoryInfo(::GetCurrentProcess(),
+                              reinterpret_cast<PROCESS_MEMORY_COUNTERS*>(&counters),
+                              sizeof(counters))) {
+    MemoryUsage result = { 0, 0 };
+    return result;
+  }
+  MemoryUsage result = { static_cast<qint64>(counters.PrivateUsage),
+                         static_cast<qint64>(counters.PeakPagefileUsage) };
+  return result;
+}
+
+#else
+
+MemoryUsage memoryUsage()
+{
+  // resident set size and its high water mark, in kB
+  MemoryUsage result = { 0, 0 };
+  std::ifstream status("/proc/self/status");
+  std::string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmRSS:") == 0) {
+      result.current = std::atoll(line.c_str() + 6) * 1024;
+    } else if (line.compare(0, 6, "VmHWM:") == 0) {
+      result.peak = std::atoll(line.c_str() + 6) * 1024;
+    }
+  }
+  return result;
+}
+
+#endif
+
+
+enum class Shape {
+  // few levels with many entries each
+  Wide,
+  // many levels with few sub-directories each
+  Deep
+};
+
+
+struct Directory {
+  int parent;
+  QString name;
+};
+
+struct File {
+  int directory;
+  QString name;
+};
+
+/**
+ * a synthetic directory structure. directories are ordered so that every parent comes
+ * before its children, directory 0 is the root
+ */
+struct Layout {
+  std::vector<Directory> directories;
+  std::vector<File> files;
+};
+
+
+const char *DirectoryNames[] = {
+  "textures", "meshes", "sound", "music", "scripts", "interface", "actors", "character",
+  "armor", "weapons", "clothes", "architecture", "landscape", "effects", "dungeons",
+  "creatures", "furniture", "clutter", "plants", "skyrim", "source", "strings", "fx",
+  "voice", "lod", "terrain", "animations", "behaviors", "male", "female"
+};
+
+const char *FileStems[] = {
+  "iron", "steel", "glass", "ebony", "daedric", "leather", "hide", "fur", "boots", "gauntlets",
+  "helmet", "cuirass", "shield", "sword", "dagger", "bow", "arrow", "body", "hand", "head",
+  "wall", "floor", "door", "chest", "barrel", "rock", "tree", "grass", "water", "cloud"
+};
+
+// weighted roughly like a texture/mesh heavy mod setup
+const char *FileExtensions[] = {
+  ".dds", ".dds", ".dds", ".dds", ".dds", ".nif", ".nif", ".nif", ".pex", ".psc",
+  ".wav", ".xwm", ".fuz", ".hkx", ".esp", ".txt"
+};
+
+template <typename T, std::size_t N>
+std::size_t arraySize(T (&)[N]) { return N; }
+
+
+QString randomCase(QString name, std::mt19937 &random)
+{
+  // a fifth of all names are capitalized, some are shouted
+  unsigned int choice = random() % 20;
+  if (choice < 4) {
+    name = name.left(1).toUpper() + name.mid(1);
+  } else if (choice == 4) {
+    name = name.toUpper();
+  }
+  return name;
+}
+
+
+QString directoryName(int childIndex, std::mt19937 &random)
+{
+  int count = static_cast<int>(arraySize(DirectoryNames));
+  QString name = DirectoryNames[(childIndex + random() % count) % count];
+  // the suffix keeps siblings unique
+  name += QString("_%1").arg(childIndex);
+  return randomCase(name, random);
+}
+
+
+QString fileName(int fileIndex, std::mt19937 &random)
+{
+  QString name = FileStems[random() % arraySize(FileStems)];
+  name += QString("_%1").arg(fileIndex);
+  name += FileExtensions[random() % arraySize(FileExtensions)];
+  return randomCase(name, random);
+}
+
+
+Layout generateLayout(int leafCount, Shape shape, unsigned int seed)
+{
+  std::mt19937 random(seed);
+
+  int depth = (shape == Shape::Wide) ? 3 : 12;
+  int filesPerDirectory = (shape == Shape::Wide) ? 200 : 20;
+  int leafDirectories = std::max(1, leafCount / filesPerDirectory);
+  int branching = std::max(2, static_cast<int>(std::ceil(std::pow(leafDirectories, 1.0 / depth))));
+
+  Layout result;
+  Directory root = { -1, QString() };
+  result.directories.push_back(root);
+
+  // complete tree with the given branching, level by level, until there are enough
+  // directories on the last level
+  std::vector<int> level(1, 0);
+  for (int i = 0; (i < depth) && (static_cast<int>(level.size()) < leafDirectories); ++i) {
+    std::vector<int> nextLevel;
+    for (int parent : level) {
+      for (int child = 0; child < branching; ++child) {
+        Directory directory = { parent, directoryName(child, random) };
+        nextLevel.push_back(static_cast<int>(result.directories.size()));
+        result.directories.push_back(directory);
+      }
+    }
+    level.swap(nextLevel);
+  }
+
+  // most files go into the deepest directories, the rest is spread over all directories
+  for (int i = 0; i < leafCount; ++i) {
+    int directory;
+    if (random() % 10 == 0) {
+      directory = random() % result.directories.size();
+    } else {
+      directory = level[random() % level.size()];
+    }
+    File file = { directory, fileName(i, random) };
+    result.files.push_back(file);
+  }
+  return result;
+}
+
+
+class Benchmark {
+public:
+  Benchmark(const char *shape, const char *allocation, int leafCount)
+    : m_Shape(shape), m_Allocation(allocation), m_LeafCount(leafCount)
+  {}
+
+  void start() { m_Timer.start(); }
+
+  void report(const char *operation, qint64 operations)
+  {
+    double milliseconds = m_Timer.nsecsElapsed() / 1000000.0;
+    double perSecond = (milliseconds > 0.0) ? operations * 1000.0 / milliseconds : 0.0;
+    printf("%-5s %-6s %8d  %-20s %10.1f ms %14.0f ops/s\n",
+           m_Shape, m_Allocation, m_LeafCount, operation, milliseconds, perSecond);
+  }
+
+private:
+  const char *m_Shape;
+  const char *m_Allocation;
+  int m_LeafCount;
+  QElapsedTimer m_Timer;
+};
+
+
+#ifdef TREEBENCHMARK_BASELINE
+
+// the baseline tree allocates every node on the heap and looks nodes up by their node data
+typedef DirectoryTreeInformation NodeKey;
+
+DirectoryTree *createTree(bool)
+{
+  return new DirectoryTree;
+}
+
+DirectoryTree *createNode(DirectoryTree&)
+{
+  return new DirectoryTree;
+}
+
+#else // TREEBENCHMARK_BASELINE
+
+typedef FileNameString NodeKey;
+
+DirectoryTree *createTree(bool useArena)
+{
+  return new DirectoryTree(useArena ? std::make_shared<TreeArena>() : std::shared_ptr<TreeArena>());
+}
+
+DirectoryTree *createNode(DirectoryTree &tree)
+{
+  return tree.createNode();
+}
+
+#endif // TREEBENCHMARK_BASELINE
+
+
+/**
+ * creates the directories of a layout in a tree
+ * @return the node for every directory of the layout
+ */
+std::vector<DirectoryTree*> buildNodes(DirectoryTree &tree, const Layout &layout)
+{
+  std::vector<DirectoryTree*> nodes;
+  nodes.reserve(layout.directories.size());
+  nodes.push_back(&tree);
+  for (std::size_t i = 1; i < layout.directories.size(); ++i) {
+    const Directory &directory = layout.directories[i];
+    DirectoryTree *node = createNode(tree);
+    node->setData(DirectoryTreeInformation(directory.name, static_cast<int>(i)));
+    nodes[directory.parent]->addNode(node, false);
+    nodes.push_back(node);
+  }
+  return nodes;
+}
+
+
+/**
+ * adds every step-th file of a layout, starting with first, to the nodes created by buildNodes
+ */
+void addLeafs(const std::vector<DirectoryTree*> &nodes, const Layout &layout,
+              std::size_t first, std::size_t step, std::size_t indexOffset)
+{
+  for (std::size_t i = first; i < layout.files.size(); i += step) {
+    const File &file = layout.files[i];
+    nodes[file.directory]->addLeaf(FileTreeInformation(file.name, i + indexOffset));
+  }
+}
+
+
+#ifndef TREEBENCHMARK_BASELINE
+
+/**
+ * builds a CowDirectoryTree with the content of a layout. Every directory gets its leafs and
+ * sub-directories in one batch, children are completed before their parent since they come
+ * after it in the layout
+ */
+CowDirectoryTree buildCowTree(const Layout &layout, std::size_t first, std::size_t step,
+                              std::size_t indexOffset)
+{
+  std::vector<std::vector<FileTreeInformation>> leafs(layout.directories.size());
+  for (std::size_t i = first; i < layout.files.size(); i += step) {
+    const File &file = layout.files[i];
+    leafs[file.directory].push_back(FileTreeInformation(file.name, i + indexOffset));
+  }
+  std::vector<std::vector<int>> children(layout.directories.size());
+  for (std::size_t i = 1; i < layout.directories.size(); ++i) {
+    children[layout.directories[i].parent].push_back(static_cast<int>(i));
+  }
+
+  std::vector<CowDirectoryTree> nodes(layout.directories.size());
+  for (std::size_t i = layout.directories.size(); i-- > 0;) {
+    CowDirectoryTree &node = nodes[i];
+    if (i != 0) {
+      node.setData(DirectoryTreeInformation(layout.directories[i].name, static_cast<int>(i)));
+    }
+    node.addLeafs(leafs[i].begin(), leafs[i].end());
+    std::vector<CowDirectoryTree> subNodes;
+    for (int child : children[i]) {
+      subNodes.push_back(nodes[child]);
+    }
+    node.addNodes(subNodes.begin(), subNodes.end(), false);
+  }
+  return nodes[0];
+}
+
+
+/**
+ * the copy-on-write tree, built in batches with the same content as the regular tree
+ */
+void runCow(Benchmark &benchmark, const Layout &layout)
+{
+  std::size_t numDirectories = layout.directories.size() - 1;
+
+  benchmark.start();
+  CowDirectoryTree tree = buildCowTree(layout, 0, 1, 0);
+  benchmark.report("cow build", layout.files.size() + numDirectories);
+
+  // a speculative change on a copy only duplicates the path to the modified node
+  std::vector<FileTreeInformation> added;
+  for (std::size_t i = 0; i < layout.files.size(); i += 100) {
+    added.push_back(FileTreeInformation(layout.files[i].name + ".bak", i));
+  }
+  benchmark.start();
+  CowDirectoryTree copy = tree;
+  CowDirectoryTree *node = &copy;
+  while (node->numNodes() != 0) {
+    node = node->findNode(node->nodesBegin()->getData());
+  }
+  node->addLeafs(added.begin(), added.end());
+  benchmark.report("cow copy+modify", added.size());
+
+  CowDirectoryTree overlay = buildCowTree(layout, 0, 2, layout.files.size());
+  benchmark.start();
+  for (auto iter = overlay.nodesBegin(); iter != overlay.nodesEnd(); ++iter) {
+    tree.addNode(*iter, true);
+  }
+  benchmark.report("cow addNode (merge)", (layout.files.size() + 1) / 2 + numDirectories);
+}
+
+
+#endif // TREEBENCHMARK_BASELINE
+
+
+/**
+ * calls the visitor for node and every node below it, parents before their children
+ */
+template <typename VisitorT>
+void forEachNode(const DirectoryTree &node, VisitorT &visitor)
+{
+  visitor(node);
+  for (auto iter = node.nodesBegin(); iter != node.nodesEnd(); ++iter) {
+    forEachNode(**iter, visitor);
+  }
+}
+
+
+void run(int leafCount, Shape shape, bool useArena)
+{
+  const char *shapeName = (shape == Shape::Wide) ? "wide" : "deep";
+  const char *allocationName = useArena ? "arena" : "heap";
+  Benchmark benchmark(shapeName, allocationName, leafCount);
+
+  Layout layout = generateLayout(leafCount, shape, 42);
+  std::size_t numDirectories = layout.directories.size() - 1;
+
+  MemoryUsage before = memoryUsage();
+
+  DirectoryTree *tree = createTree(useArena);
+  benchmark.start();
+  std::vector<DirectoryTree*> nodes = buildNodes(*tree, layout);
+  benchmark.report("addNode", numDirectories);
+
+  benchmark.start();
+  addLeafs(nodes, layout, 0, 1, 0);
+  benchmark.report("addLeaf", layout.files.size());
+
+  MemoryUsage built = memoryUsage();
+
+  // resolve every directory from the root, one nodeFind per path segment
+  std::vector<std::vector<NodeKey>> paths;
+  for (std::size_t i = 1; i < layout.directories.size(); ++i) {
+    std::vector<NodeKey> path;
+    for (int directory = static_cast<int>(i); directory != 0; directory = layout.directories[directory].parent) {
+      path.push_back(layout.directories[directory].name.toLower());
+    }
+    std::reverse(path.begin(), path.end());
+    paths.push_back(path);
+  }
+  std::shuffle(paths.begin(), paths.end(), std::mt19937(7));
+  std::size_t lookups = 0;
+  std::size_t misses = 0;
+  benchmark.start();
+  for (const std::vector<NodeKey> &path : paths) {
+    const DirectoryTree *node = tree;
+    for (const NodeKey &name : path) {
+      auto iter = node->nodeFind(name);
+      ++lookups;
+      if (iter == node->nodesEnd()) {
+        ++misses;
+        break;
+      }
+      node = *iter;
+    }
+  }
+  benchmark.report("nodeFind", lookups);
+  if (misses != 0) {
+    printf("error: %d directories not found\n", static_cast<int>(misses));
+  }
+
+  std::size_t totalLength = 0;
+  benchmark.start();
+  auto fullPaths = [&totalLength] (const DirectoryTree &node) {
+    for (auto leaf = node.leafsBegin(); leaf != node.leafsEnd(); ++leaf) {
+      totalLength += node.getFullPath(&*leaf).size();
+    }
+  };
+  forEachNode(*tree, fullPaths);
+  benchmark.report("getFullPath", layout.files.size());
+
+  benchmark.start();
+  DirectoryTree *copy = tree->copy();
+  benchmark.report("copy", layout.files.size() + numDirectories);
+
+  benchmark.start();
+  delete copy;
+  benchmark.report("destroy", layout.files.size() + numDirectories);
+
+  // the overlay contains every directory and every second file of the tree, so half of its
+  // leafs overwrite existing ones
+  std::unique_ptr<DirectoryTree> overlay(createTree(useArena));
+  std::vector<DirectoryTree*> overlayNodes = buildNodes(*overlay, layout);
+  addLeafs(overlayNodes, layout, 0, 2, layout.files.size());
+  DirectoryTree::Overwrites overwrites;
+  benchmark.start();
+  for (auto iter = overlay->nodesBegin(); iter != overlay->nodesEnd();) {
+    DirectoryTree *node = *iter;
+    iter = overlay->detach(iter);
+    tree->addNode(node, true, &overwrites);
+  }
+  benchmark.report("addNode (merge)", (layout.files.size() + 1) / 2 + numDirectories);
+
+  benchmark.start();
+  delete tree;
+  benchmark.report("destroy (merged)", layout.files.size() + numDirectories);
+
+  MemoryUsage after = memoryUsage();
+  printf("%-5s %-6s %8d  %.1f bytes/leaf, peak %.1f MB, %d overwrites, %d path characters\n",
+         shapeName, allocationName, leafCount,
+         static_cast<double>(built.current - before.current) / leafCount,
+         after.peak / (1024.0 * 1024.0),
+         static_cast<int>(overwrites.size()), static_cast<int>(totalLength));
+
+#ifndef TREEBENCHMARK_BASELINE
+  // the copy-on-write tree doesn't use the arena, run it once per shape
+  if (!useArena) {
+    runCow(benchmark, layout);
+  }
+#endif // TREEBENCHMARK_BASELINE
+}
+
+} // namespace
+
+
+int main(int argc, char *argv[])
+{
+  // a single configuration, run in a process of its own so the memory figures aren't
+  // distorted by memory the allocator kept from earlier runs
+  if ((argc == 5) && (strcmp(argv[1], "--run") == 0)) {
+    int leafCount = std::atoi(argv[2]);
+    Shape shape = (strcmp(argv[3], "deep") == 0) ? Shape::Deep : Shape::Wide;
+    bool useArena = strcmp(argv[4], "arena") == 0;
+    run(leafCount, shape, useArena);
+    return 0;
+  }
+
+  std::vector<int> leafCounts;
+  for (int i = 1; i < argc; ++i) {
+    int count = std::atoi(argv[i]);
+    if (count <= 0) {
+      fprintf(stderr, "usage: %s [leaf count]...\n", argv[0]);
+      return 1;
+    }
+    leafCounts.push_back(count);
+  }
+  if (leafCounts.empty()) {
+    leafCounts.push_back(10000);
+    leafCounts.push_back(100000);
+    leafCounts.push_back(1000000);
+  }
+
+  printf("%d bytes per FileNameString, %d bytes per FileTreeInformation\n",
+         static_cast<int>(sizeof(FileNameString)), static_cast<int>(sizeof(FileTreeInformation)));
+
+  QString program = QString::fromLocal8Bit(argv[0]);
+  for (int leafCount : leafCounts) {
+    for (const char *shape : { "wide", "deep" }) {
+#ifdef TREEBENCHMARK_BASELINE
+      for (const char *allocation : { "heap" }) {
+#else // TREEBENCHMARK_BASELINE
+      for (const char *allocation : { "heap", "arena" }) {
+#endif // TREEBENCHMARK_BASELINE
+        QStringList arguments;
+        arguments << "--run" << QString::number(leafCount) << shape << allocation;
+        // the output of the child is forwarded to ours
+        if (QProcess::execute(program, arguments) != 0) {
+          fprintf(stderr, "benchmark failed: %d leafs, %s, %s\n", leafCount, shape, allocation);
+          return 1;
+        }
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,441 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef COWTREE_H
+#define COWTREE_H
+
+#include "mytree.h"
+
+#include <QSharedData>
+#include <QSharedDataPointer>
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+namespace MOBase {
+
+
+/**
+ * an implicitly shared counterpart to MyTree. Copying a CowTree is O(1), copies share all
+ * nodes until one of them is modified. Modifying a node only duplicates that node and the
+ * nodes on the path leading to it (each with its direct leafs and sub-node handles),
+ * unchanged subtrees stay shared.
+ * This is meant for speculative restructuring: take a copy, try changes on it and throw it
+ * away or convert it back to a MyTree with toTree.
+ * leafs and nodes are kept in sorted vectors, ordered by Order like in the corresponding
+ * MyTree. Lookups are O(log n) but adding or removing a single entry is O(n), so larger
+ * batches should go through addLeafs/addNodes which sort once and merge in linear time.
+ * @note nodes don't know their parent since a node can be part of many trees at once
+ **/
+template <typename LeafT, typename NodeData, typename Order = std::less<>>
+class CowTree
+{
+
+public:
+
+  typedef MyTree<LeafT, NodeData, Order> Tree;
+
+  typedef typename std::vector<LeafT>::const_iterator const_leaf_iterator;
+  typedef typename std::vector<CowTree>::const_iterator const_node_iterator;
+
+public:
+
+  /**
+   * @brief constructor
+   **/
+  CowTree()
+    : d(new Data)
+  {}
+
+  /**
+   * @brief create a shareable copy of a tree
+   * @param tree the tree to copy. This is a deep copy
+   **/
+  explicit CowTree(const Tree &tree);
+
+  /**
+   * @brief create a regular tree from this one
+   * @param arena arena to allocate the new tree from. If this is empty the tree is allocated
+   *              on the heap
+   * @return a new tree with the same content, the caller takes custody
+   **/
+  Tree *toTree(const std::shared_ptr<TreeArena> &arena = std::shared_ptr<TreeArena>()) const;
+
+  /**
+   * @return true if this and other refer to the same, shared node
+   **/
+  bool isSharedWith(const CowTree &other) const { return d.constData() == other.d.constData(); }
+
+  /**
+   * @brief set the data for this node
+   **/
+  void setData(const NodeData &data) { d->data = data; }
+
+  /**
+   * @return data connected to this node
+   **/
+  const NodeData &getData() const { return d->data; }
+
+  /**
+   * @return the number of leafs in the current node
+   **/
+  std::size_t numLeafs() const { return d->leafs.size(); }
+
+  /**
+   * @return the number of child-nodes in the current node
+   **/
+  std::size_t numNodes() const { return d->nodes.size(); }
+
+  const_leaf_iterator leafsBegin() const { return d->leafs.begin(); }
+  const_leaf_iterator leafsEnd() const { return d->leafs.end(); }
+  const_node_iterator nodesBegin() const { return d->nodes.begin(); }
+  const_node_iterator nodesEnd() const { return d->nodes.end(); }
+
+  /**
+   * @brief add a new leaf to this node. This is O(n) in the number of leafs of the node
+   *
+   * @param leaf the leaf data to attach
+   * @param overwrite if true, the new leaf will overwrite an existing one that compares
+   *                  as "equal"
+   * @return true if the leaf was added, false if it already exists
+   **/
+  bool addLeaf(const LeafT &leaf, bool overwrite = true);
+
+  /**
+   * @brief add a range of leafs to this node. The range is sorted once and merged with the
+   *        existing leafs, the result is the same as calling addLeaf for each leaf in order
+   *
+   * @param begin start of the leafs to add, they don't have to be sorted
+   * @param end end of the leafs to add
+   * @param overwrite if true, new leafs overwrite existing ones that compare as "equal"
+   **/
+  template <typename IteratorT>
+  void addLeafs(IteratorT begin, IteratorT end, bool overwrite = true);
+
+  /**
+   * @brief remove the leaf comparing equal to the specified one
+   * @return true if a leaf was removed
+   **/
+  bool eraseLeaf(const LeafT &leaf);
+
+  /**
+   * @return the sub-node matching the key or nullptr
+   **/
+  template <typename KeyT>
+  const CowTree *findNode(const KeyT &key) const;
+
+  /**
+   * @brief find a sub-node for modification. This unshares this node
+   * @return the sub-node matching the key or nullptr
+   **/
+  template <typename KeyT>
+  CowTree *findNode(const KeyT &key);
+
+  /**
+   * @brief add a sub-node. Unless the sub-node has to be merged with an existing one it
+   *        stays shared with the tree it came from
+   *
+   * @param node the node to add
+   * @param merge if true the content of node will be merged with an existing node
+   * @return true if the node was added or merged. false if merge is false and a node with
+   *         the same node data exists already
+   **/
+  bool addNode(const CowTree &node, bool merge);
+
+  /**
+   * @brief add a range of sub-nodes. The range is sorted once and merged with the existing
+   *        nodes, the result is the same as calling addNode for each node in order
+   *
+   * @param begin start of the nodes to add, they don't have to be sorted
+   * @param end end of the nodes to add
+   * @param merge if true the content of nodes will be merged with existing nodes
+   **/
+  template <typename IteratorT>
+  void addNodes(IteratorT begin, IteratorT end, bool merge);
+
+  /**
+   * @brief remove the sub-node matching the key
+   * @return the removed node. If no node matched, this is an empty node
+   **/
+  template <typename KeyT>
+  CowTree takeNode(const KeyT &key);
+
+private:
+
+  struct Data : public QSharedData
+  {
+    NodeData data;
+    // both sorted, the same way MyTree orders them
+    std::vector<LeafT> leafs;
+    std::vector<CowTree> nodes;
+  };
+
+  struct ByNodeData
+  {
+    bool operator()(const CowTree &lhs, const CowTree &rhs) const {
+      return Order()(lhs.getData(), rhs.getData());
+    }
+    template <typename KeyT>
+    bool operator()(const CowTree &lhs, const KeyT &rhs) const {
+      return Order()(lhs.getData(), rhs);
+    }
+  };
+
+private:
+
+  void fillTree(Tree &tree) const;
+
+  /**
+   * merge the leafs and sub-nodes of node into this node
+   **/
+  void mergeContent(const CowTree &node);
+
+private:
+
+  QSharedDataPointer<Data> d;
+
+};
+
+
+template <typename LeafT, typename NodeData, typename Order>
+CowTree<LeafT, NodeData, Order>::CowTree(const Tree &tree)
+  : d(new Data)
+{
+  d->data = tree.getData();
+  d->leafs.assign(tree.leafsBegin(), tree.leafsEnd());
+  d->nodes.reserve(tree.numNodes());
+  for (auto iter = tree.nodesBegin(); iter != tree.nodesEnd(); ++iter) {
+    d->nodes.push_back(CowTree(**iter));
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+typename CowTree<LeafT, NodeData, Order>::Tree *CowTree<LeafT, NodeData, Order>::toTree(const std::shared_ptr<TreeArena> &arena) const
+{
+  Tree *result = new (arena) Tree(arena);
+  fillTree(*result);
+  return result;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void CowTree<LeafT, NodeData, Order>::fillTree(Tree &tree) const
+{
+  tree.setData(d->data);
+  for (const LeafT &leaf : d->leafs) {
+    tree.addLeaf(leaf);
+  }
+  for (const CowTree &node : d->nodes) {
+    Tree *subTree = tree.createNode();
+    node.fillTree(*subTree);
+    tree.addNode(subTree, false);
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+bool CowTree<LeafT, NodeData, Order>::addLeaf(const LeafT &leaf, bool overwrite)
+{
+  const std::vector<LeafT> &leafs = d.constData()->leafs;
+  auto pos = std::lower_bound(leafs.begin(), leafs.end(), leaf, Order());
+  bool exists = (pos != leafs.end()) && !Order()(leaf, *pos);
+  if (exists && !overwrite) {
+    return false;
+  }
+  std::size_t offset = pos - leafs.begin();
+  // non-const access unshares the node
+  if (exists) {
+    d->leafs[offset] = leaf;
+  } else {
+    d->leafs.insert(d->leafs.begin() + offset, leaf);
+  }
+  return true;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+bool CowTree<LeafT, NodeData, Order>::eraseLeaf(const LeafT &leaf)
+{
+  const std::vector<LeafT> &leafs = d.constData()->leafs;
+  auto pos = std::lower_bound(leafs.begin(), leafs.end(), leaf, Order());
+  if ((pos == leafs.end()) || Order()(leaf, *pos)) {
+    return false;
+  }
+  std::size_t offset = pos - leafs.begin();
+  d->leafs.erase(d->leafs.begin() + offset);
+  return true;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+template <typename KeyT>
+const CowTree<LeafT, NodeData, Order> *CowTree<LeafT, NodeData, Order>::findNode(const KeyT &key) const
+{
+  const std::vector<CowTree> &nodes = d->nodes;
+  auto pos = std::lower_bound(nodes.begin(), nodes.end(), key, ByNodeData());
+  if ((pos == nodes.end()) || Order()(key, pos->getData())) {
+    return nullptr;
+  }
+  return &*pos;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+template <typename KeyT>
+CowTree<LeafT, NodeData, Order> *CowTree<LeafT, NodeData, Order>::findNode(const KeyT &key)
+{
+  const CowTree *node = static_cast<const CowTree*>(this)->findNode(key);
+  if (node == nullptr) {
+    return nullptr;
+  }
+  std::size_t offset = node - d.constData()->nodes.data();
+  return &d->nodes[offset];
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+bool CowTree<LeafT, NodeData, Order>::addNode(const CowTree &node, bool merge)
+{
+  const std::vector<CowTree> &nodes = d.constData()->nodes;
+  auto pos = std::lower_bound(nodes.begin(), nodes.end(), node.getData(), ByNodeData());
+  std::size_t offset = pos - nodes.begin();
+  if ((pos == nodes.end()) || Order()(node.getData(), pos->getData())) {
+    d->nodes.insert(d->nodes.begin() + offset, node);
+    return true;
+  } else if (merge) {
+    d->nodes[offset].mergeContent(node);
+    return true;
+  }
+  return false;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void CowTree<LeafT, NodeData, Order>::mergeContent(const CowTree &node)
+{
+  // node may share its data with this one, keep it alive while this node is modified
+  CowTree source(node);
+  addNodes(source.nodesBegin(), source.nodesEnd(), true);
+  addLeafs(source.leafsBegin(), source.leafsEnd(), true);
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+template <typename IteratorT>
+void CowTree<LeafT, NodeData, Order>::addLeafs(IteratorT begin, IteratorT end, bool overwrite)
+{
+  // stable, so of leafs comparing equal the one added last comes last
+  std::vector<LeafT> added(begin, end);
+  std::stable_sort(added.begin(), added.end(), Order());
+
+  const std::vector<LeafT> &leafs = d.constData()->leafs;
+  std::vector<LeafT> result;
+  result.reserve(leafs.size() + added.size());
+  bool changed = false;
+  auto existing = leafs.begin();
+  for (auto iter = added.begin(); iter != added.end();) {
+    auto runEnd = iter + 1;
+    while ((runEnd != added.end()) && !Order()(*iter, *runEnd)) {
+      ++runEnd;
+    }
+    while ((existing != leafs.end()) && Order()(*existing, *iter)) {
+      result.push_back(*existing++);
+    }
+    if ((existing != leafs.end()) && !Order()(*iter, *existing)) {
+      result.push_back(overwrite ? *(runEnd - 1) : *existing);
+      changed = changed || overwrite;
+      ++existing;
+    } else {
+      result.push_back(overwrite ? *(runEnd - 1) : *iter);
+      changed = true;
+    }
+    iter = runEnd;
+  }
+  // don't unshare the node if nothing was added
+  if (changed) {
+    result.insert(result.end(), existing, leafs.end());
+    d->leafs.swap(result);
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+template <typename IteratorT>
+void CowTree<LeafT, NodeData, Order>::addNodes(IteratorT begin, IteratorT end, bool merge)
+{
+  std::vector<CowTree> added(begin, end);
+  std::stable_sort(added.begin(), added.end(), ByNodeData());
+
+  const std::vector<CowTree> &nodes = d.constData()->nodes;
+  std::vector<CowTree> result;
+  result.reserve(nodes.size() + added.size());
+  bool changed = false;
+  auto existing = nodes.begin();
+  for (auto iter = added.begin(); iter != added.end();) {
+    auto runEnd = iter + 1;
+    while ((runEnd != added.end()) && !ByNodeData()(*iter, *runEnd)) {
+      ++runEnd;
+    }
+    while ((existing != nodes.end()) && ByNodeData()(*existing, *iter)) {
+      result.push_back(*existing++);
+    }
+    // without merge only the first node of a name is added, the same way addNode would
+    // reject the later ones
+    if ((existing != nodes.end()) && !ByNodeData()(*iter, *existing)) {
+      result.push_back(*existing++);
+    } else {
+      result.push_back(*iter++);
+      changed = true;
+    }
+    if (merge) {
+      for (; iter != runEnd; ++iter) {
+        result.back().mergeContent(*iter);
+        changed = true;
+      }
+    }
+    iter = runEnd;
+  }
+  if (changed) {
+    result.insert(result.end(), existing, nodes.end());
+    d->nodes.swap(result);
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+template <typename KeyT>
+CowTree<LeafT, NodeData, Order> CowTree<LeafT, NodeData, Order>::takeNode(const KeyT &key)
+{
+  const CowTree *node = static_cast<const CowTree*>(this)->findNode(key);
+  if (node == nullptr) {
+    return CowTree();
+  }
+  CowTree result = *node;
+  std::size_t offset = node - d.constData()->nodes.data();
+  d->nodes.erase(d->nodes.begin() + offset);
+  return result;
+}
+
+} // namespace MOBase
+
+#endif // COWTREE_H
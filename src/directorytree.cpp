@@ -19,20 +19,285 @@ along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "directorytree.h"
 
+#include <QSet>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <thread>
+
 namespace MOBase {
 
+
+// below this number of entries building the tree on a single thread is faster
+static const std::size_t ParallelBuildThreshold = 16384;
+
+
+/**
+ * inserts paths into a tree, remembering the directories of the previous path so
+ * sorted input doesn't have to look up shared parent directories again
+ */
+class DirectoryTreeBuilder
+{
+public:
+
+  DirectoryTreeBuilder(DirectoryTree &tree)
+    : m_Tree(tree)
+  {
+  }
+
+  void add(const DirectoryTreeEntry &entry)
+  {
+    splitPath(entry.path);
+    if (m_Components.empty()) {
+      return;
+    }
+
+    std::size_t numDirectories = entry.isDirectory ? m_Components.size() : m_Components.size() - 1;
+
+    // reuse the directories the previous path shares with this one
+    std::size_t depth = 0;
+    while ((depth < m_Stack.size()) && (depth < numDirectories)
+           && (m_Stack[depth].first == m_Components[depth])) {
+      ++depth;
+    }
+    m_Stack.resize(depth);
+
+    for (; depth < numDirectories; ++depth) {
+      DirectoryTree *parent = depth == 0 ? &m_Tree : m_Stack.back().second;
+      const FileNameString &name = intern(m_Components[depth]);
+      DirectoryTree *node = nullptr;
+      auto iter = parent->nodeFind(name);
+      if (iter != parent->nodesEnd()) {
+        node = *iter;
+      } else {
+        node = parent->createNode();
+        DirectoryTreeInformation information;
+        information.name = name;
+        node->setData(information);
+        parent->addNode(node, false);
+      }
+      m_Stack.push_back(std::make_pair(name, node));
+    }
+
+    if (entry.isDirectory) {
+      DirectoryTree *node = m_Stack.back().second;
+      DirectoryTreeInformation information = node->getData();
+      information.index = entry.index;
+      node->setData(information);
+    } else {
+      DirectoryTree *parent = numDirectories == 0 ? &m_Tree : m_Stack.back().second;
+      parent->addLeaf(FileTreeInformation(m_Components.back(), entry.index, entry.size));
+    }
+  }
+
+private:
+
+  void splitPath(const QString &path)
+  {
+    m_Components.clear();
+    const QChar *data = path.constData();
+    int size = path.size();
+    int start = 0;
+    for (int i = 0; i <= size; ++i) {
+      if ((i == size) || (data[i] == '/') || (data[i] == '\\')) {
+        if (i > start) {
+          m_Components.push_back(QString(data + start, i - start));
+        }
+        start = i + 1;
+      }
+    }
+  }
+
+  // directory names repeat a lot (textures, meshes, ...). The interned name serves the
+  // lookup, the node and the stack, and names too long to be stored inline share one block
+  const FileNameString &intern(const QString &name)
+  {
+    return *m_Names.insert(FileNameString(name));
+  }
+
+private:
+
+  DirectoryTree &m_Tree;
+  std::vector<QString> m_Components;
+  std::vector<std::pair<FileNameString, DirectoryTree*>> m_Stack;
+  QSet<FileNameString> m_Names;
+
+};
+
+
+static QString topLevelName(const DirectoryTreeEntry &entry)
+{
+  const QChar *data = entry.path.constData();
+  int size = entry.path.size();
+  int start = 0;
+  while ((start < size) && ((data[start] == '/') || (data[start] == '\\'))) {
+    ++start;
+  }
+  int end = start;
+  while ((end < size) && (data[end] != '/') && (data[end] != '\\')) {
+    ++end;
+  }
+  if ((end == size) && !entry.isDirectory) {
+    // a file in the top level directory
+    return QString();
+  }
+  return QString(data + start, end - start);
+}
+
+
+void buildDirectoryTree(DirectoryTree &tree, const std::vector<DirectoryTreeEntry> &entries,
+                        unsigned int numThreads)
+{
+  if (numThreads == 0) {
+    numThreads = std::max(1U, std::thread::hardware_concurrency());
+  }
+
+  if ((numThreads == 1) || (entries.size() < ParallelBuildThreshold)) {
+    DirectoryTreeBuilder builder(tree);
+    for (const DirectoryTreeEntry &entry : entries) {
+      builder.add(entry);
+    }
+    return;
+  }
+
+  // group the entries by top-level directory. Each group becomes an independent subtree
+  DirectoryTreeBuilder topLevelBuilder(tree);
+  std::map<FileNameString, std::size_t> groupIndices;
+  std::vector<std::vector<const DirectoryTreeEntry*>> groups;
+  for (const DirectoryTreeEntry &entry : entries) {
+    QString name = topLevelName(entry);
+    if (name.isEmpty()) {
+      topLevelBuilder.add(entry);
+      continue;
+    }
+    auto res = groupIndices.insert(std::make_pair(FileNameString(name), groups.size()));
+    if (res.second) {
+      groups.push_back(std::vector<const DirectoryTreeEntry*>());
+    }
+    groups[res.first->second].push_back(&entry);
+  }
+
+  // every thread builds its groups into a tree of its own with its own arena since arenas
+  // aren't thread safe
+  numThreads = std::min<unsigned int>(numThreads, static_cast<unsigned int>(groups.size()));
+  std::vector<std::unique_ptr<DirectoryTree>> partialTrees;
+  for (unsigned int i = 0; i < numThreads; ++i) {
+    if (tree.arena()) {
+      partialTrees.push_back(std::unique_ptr<DirectoryTree>(new DirectoryTree(std::make_shared<TreeArena>())));
+    } else {
+      partialTrees.push_back(std::unique_ptr<DirectoryTree>(new DirectoryTree()));
+    }
+  }
+
+  std::vector<std::thread> threads;
+  for (unsigned int i = 0; i < numThreads; ++i) {
+    threads.push_back(std::thread([&groups, &partialTrees, i, numThreads] () {
+      DirectoryTreeBuilder builder(*partialTrees[i]);
+      for (std::size_t group = i; group < groups.size(); group += numThreads) {
+        for (const DirectoryTreeEntry *entry : groups[group]) {
+          builder.add(*entry);
+        }
+      }
+    }));
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  for (const std::unique_ptr<DirectoryTree> &partialTree : partialTrees) {
+    for (auto iter = partialTree->nodesBegin(); iter != partialTree->nodesEnd();) {
+      DirectoryTree *node = *iter;
+      iter = partialTree->detach(iter);
+      tree.addNode(node, true);
+    }
+  }
+}
+
+
 bool operator<(const FileTreeInformation &LHS, const FileTreeInformation &RHS) {
   return LHS.m_Name < RHS.m_Name;
 }
 
 
+bool operator<(const FileTreeInformation &LHS, const FileNameString &RHS)
+{
+  return LHS.getName() < RHS;
+}
+
+
+bool operator<(const FileNameString &LHS, const FileTreeInformation &RHS)
+{
+  return LHS < RHS.getName();
+}
+
+
+FileClass fileClass(const FileNameString &name)
+{
+  static const struct {
+    const char *extension;
+    FileClass fileClass;
+  } classes[] = {
+    { "esp", FileClassPlugin }, { "esm", FileClassPlugin }, { "esl", FileClassPlugin },
+    { "bsa", FileClassArchive }, { "ba2", FileClassArchive },
+    { "dds", FileClassTexture }, { "tga", FileClassTexture },
+    { "nif", FileClassMesh }, { "tri", FileClassMesh },
+    { "hkx", FileClassAnimation },
+    { "pex", FileClassScript }, { "psc", FileClassScript },
+    { "wav", FileClassSound }, { "xwm", FileClassSound }, { "fuz", FileClassSound },
+    { "lip", FileClassSound },
+    { "swf", FileClassInterface },
+    { "ini", FileClassIni },
+    { "dll", FileClassLibrary },
+    { "txt", FileClassDocumentation }, { "pdf", FileClassDocumentation },
+    { "htm", FileClassDocumentation }, { "html", FileClassDocumentation },
+    { "md", FileClassDocumentation },
+  };
+
+  // all known extensions are short and ascii, compare the case folded name against them
+  // without building a string
+  const QChar *folded = name.foldedData();
+  int size = name.size();
+  int dot = size - 1;
+  while ((dot >= 0) && (size - dot <= 5) && (folded[dot] != '.')) {
+    --dot;
+  }
+  if ((dot < 0) || (folded[dot] != '.')) {
+    return FileClassOther;
+  }
+  int length = size - dot - 1;
+  for (const auto &entry : classes) {
+    if ((static_cast<int>(std::strlen(entry.extension)) == length)
+        && std::equal(entry.extension, entry.extension + length, folded + dot + 1,
+                      [] (char lhs, QChar rhs) { return rhs.unicode() == static_cast<ushort>(lhs); })) {
+      return entry.fileClass;
+    }
+  }
+  return FileClassOther;
+}
+
+
 bool operator<(const DirectoryTreeInformation &LHS, const DirectoryTreeInformation &RHS)
 {
   return LHS.name < RHS.name;
 }
 
-template <>
-QString DirectoryTree::getFullPath(FileTreeInformation const *leaf) const
+
+bool operator<(const DirectoryTreeInformation &LHS, const FileNameString &RHS)
+{
+  return LHS.name < RHS;
+}
+
+
+bool operator<(const FileNameString &LHS, const DirectoryTreeInformation &RHS)
+{
+  return LHS < RHS.name;
+}
+
+// shared by the specializations of getFullPath for both orders
+template <typename TreeT>
+static QString fullPath(const TreeT *node, FileTreeInformation const *leaf)
 {
   //Warning: I have difficulty persuading myself that this'll return the correct
   //result under all circumstances, but so far it seems to be fine.
@@ -41,19 +306,141 @@ QString DirectoryTree::getFullPath(FileTreeInformation const *leaf) const
   //"a" for leaves or nodes at the top of the tree
   //"a\b"  for leaves or nodes at the 2nd level of the tree
   //etc
-  QString result;
+  //The pieces are collected bottom-up and joined once at the end, prepending to the result
+  //at every level would make this quadratic in the depth of the tree
+  //A null piece stands for a separator
+  std::vector<const FileNameString*> pieces;
+  bool separate = false;
+  int length = 0;
   if (leaf != nullptr) {
-    result = leaf->getName().toQString();
+    pieces.push_back(&leaf->getName());
+    separate = !leaf->getName().isEmpty();
+    length += leaf->getName().size();
   }
-  const Node *parent = this;
+  const TreeT *parent = node;
   while (parent != nullptr) {
-    if ((parent->getParent() != nullptr)
-        && !result.isEmpty()) {
-      result.prepend("\\");
+    if ((parent->getParent() != nullptr) && separate) {
+      pieces.push_back(nullptr);
+      ++length;
     }
-    result.prepend(parent->getData().name.toQString());
+    const FileNameString &name = parent->getData().name;
+    pieces.push_back(&name);
+    separate = separate || !name.isEmpty();
+    length += name.size();
     parent = parent->getParent();
   }
+
+  QString result;
+  result.reserve(length);
+  for (auto iter = pieces.rbegin(); iter != pieces.rend(); ++iter) {
+    if (*iter == nullptr) {
+      result.append('\\');
+    } else {
+      result.append((*iter)->constData(), (*iter)->size());
+    }
+  }
+  return result;
+}
+
+template <>
+QString DirectoryTree::getFullPath(FileTreeInformation const *leaf) const
+{
+  return fullPath(this, leaf);
+}
+
+template <>
+QString NaturalDirectoryTree::getFullPath(FileTreeInformation const *leaf) const
+{
+  return fullPath(this, leaf);
+}
+
+
+DirectoryTree::PathEntry resolvePath(const DirectoryTree &node, const QString &path)
+{
+  // components up to 16 characters are stored in the FileNameString without allocating
+  std::vector<FileNameString> components;
+  const QChar *data = path.constData();
+  int size = path.size();
+  int start = 0;
+  for (int i = 0; i <= size; ++i) {
+    if ((i == size) || (data[i] == '/') || (data[i] == '\\')) {
+      if (i > start) {
+        components.push_back(FileNameString(QString::fromRawData(data + start, i - start)));
+      }
+      start = i + 1;
+    }
+  }
+  return node.findPath(components.begin(), components.end());
+}
+
+
+void appendPathComponent(QString &path, const FileNameString &name, bool topLevel)
+{
+  if (!topLevel) {
+    path.append('\\');
+  }
+  path.append(name.constData(), name.size());
+}
+
+
+DirectoryTreeLeafIterator::DirectoryTreeLeafIterator(const DirectoryTree &tree)
+  : m_Path(tree.getFullPath())
+  , m_Leaf(nullptr)
+{
+  Frame frame = { &tree, tree.leafsBegin(), tree.nodesBegin(), m_Path.size() };
+  m_Stack.push_back(frame);
+}
+
+
+bool DirectoryTreeLeafIterator::next()
+{
+  while (!m_Stack.empty()) {
+    Frame &frame = m_Stack.back();
+    if (frame.leaf != frame.node->leafsEnd()) {
+      m_Leaf = &*frame.leaf;
+      ++frame.leaf;
+      m_Path.truncate(frame.pathLength);
+      appendPathComponent(m_Path, m_Leaf->getName(), frame.node->getParent() == nullptr);
+      return true;
+    } else if (frame.child != frame.node->nodesEnd()) {
+      const DirectoryTree *child = *frame.child;
+      ++frame.child;
+      m_Path.truncate(frame.pathLength);
+      appendPathComponent(m_Path, child->getData().name, frame.node->getParent() == nullptr);
+      Frame childFrame = { child, child->leafsBegin(), child->nodesBegin(), m_Path.size() };
+      m_Stack.push_back(childFrame);
+    } else {
+      m_Stack.pop_back();
+    }
+  }
+  m_Leaf = nullptr;
+  return false;
+}
+
+
+QString DirectoryTreePathCache::path(const DirectoryTree *node)
+{
+  auto iter = m_Paths.find(node);
+  if (iter != m_Paths.end()) {
+    return iter->second;
+  }
+
+  QString result;
+  if (node->getParent() == nullptr) {
+    result = node->getData().name.toQString();
+  } else {
+    result = path(node->getParent());
+    appendPathComponent(result, node->getData().name, node->getParent()->getParent() == nullptr);
+  }
+  m_Paths[node] = result;
+  return result;
+}
+
+
+QString DirectoryTreePathCache::path(const DirectoryTree *node, const FileTreeInformation &leaf)
+{
+  QString result = path(node);
+  appendPathComponent(result, leaf.getName(), node->getParent() == nullptr);
   return result;
 }
 
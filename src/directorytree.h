@@ -22,43 +22,83 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 #define DIRECTORYTREE_H
 
 #include "mytree.h"
+#include "cowtree.h"
 #include "dllimport.h"
 #include "filenamestring.h"
+#include "naturalorder.h"
 
 #include <QMetaType>
 #include <QString>
 
+#include <unordered_map>
+#include <vector>
+
 namespace MOBase {
 
 class FileTreeInformation {
   friend QDLLEXPORT bool operator<(const FileTreeInformation &LHS, const FileTreeInformation &RHS);
 public:
-  FileTreeInformation() : m_Name(), m_Index(0) {}
-  FileTreeInformation(const FileTreeInformation &reference) : m_Name(reference.m_Name), m_Index(reference.m_Index) {}
-  FileTreeInformation(const QString &name, size_t index) : m_Name(name), m_Index(index) {}
+  FileTreeInformation() : m_Name(), m_Index(0), m_Size(0) {}
+  FileTreeInformation(const QString &name, size_t index, quint64 size = 0)
+    : m_Name(name), m_Index(index), m_Size(size) {}
   const FileNameString &getName() const { return m_Name; }
   void setName(const QString &name) { m_Name = name; }
   size_t getIndex() const { return m_Index; }
+  // size of the file in bytes, 0 if unknown
+  quint64 getSize() const { return m_Size; }
+  void setSize(quint64 size) { m_Size = size; }
 private:
   FileNameString m_Name;
   size_t m_Index;
+  quint64 m_Size;
 };
 
 //Q_DECLARE_METATYPE(FileTreeInformation)
 
+// allow leafs to be compared to names, see MyTree::findPath
+QDLLEXPORT bool operator<(const FileTreeInformation &LHS, const FileNameString &RHS);
+QDLLEXPORT bool operator<(const FileNameString &LHS, const FileTreeInformation &RHS);
+
+inline uint qHash(const FileTreeInformation &info, uint seed = 0)
+{
+  return qHash(info.getName(), seed);
+}
+
+/**
+ * classes of files installers and heuristics commonly look for, by extension. Used as the
+ * leaf classes of TreeAggregate, so an aggregate can tell i.e. whether a subtree contains
+ * any plugin with contains(FileClassPlugin)
+ */
+enum FileClass {
+  FileClassOther,
+  FileClassPlugin,        // esp, esm, esl
+  FileClassArchive,       // bsa, ba2
+  FileClassTexture,       // dds, tga
+  FileClassMesh,          // nif, tri
+  FileClassAnimation,     // hkx
+  FileClassScript,        // pex, psc
+  FileClassSound,         // wav, xwm, fuz, lip
+  FileClassInterface,     // swf
+  FileClassIni,           // ini
+  FileClassLibrary,       // dll
+  FileClassDocumentation  // txt, pdf, htm, html, md
+};
+
+/**
+ * @return the FileClass of a file name
+ */
+QDLLEXPORT FileClass fileClass(const FileNameString &name);
+
+inline TreeAggregate leafAggregate(const FileTreeInformation &info)
+{
+  return TreeAggregate(info.getSize(), fileClass(info.getName()));
+}
+
 
 struct DirectoryTreeInformation {
   DirectoryTreeInformation() : name(), index(-1) { }
-  DirectoryTreeInformation(const DirectoryTreeInformation &reference) : name(reference.name), index(reference.index) { }
   DirectoryTreeInformation(const QString &name) : name(name), index(-1) { }
   DirectoryTreeInformation(const QString &name, int index) : name(name), index(index) { }
-  DirectoryTreeInformation &operator=(const DirectoryTreeInformation &reference) {
-    if (this != &reference) {
-      name = reference.name;
-      index = reference.index;
-    }
-    return *this;
-  }
 
   FileNameString name;
   int index;
@@ -66,6 +106,15 @@ struct DirectoryTreeInformation {
 
 QDLLEXPORT bool operator<(const DirectoryTreeInformation &LHS, const DirectoryTreeInformation &RHS);
 
+// allow nodes to be looked up by name, see MyTree::nodeFind
+QDLLEXPORT bool operator<(const DirectoryTreeInformation &LHS, const FileNameString &RHS);
+QDLLEXPORT bool operator<(const FileNameString &LHS, const DirectoryTreeInformation &RHS);
+
+inline uint qHash(const DirectoryTreeInformation &info, uint seed = 0)
+{
+  return qHash(info.name, seed);
+}
+
 
 /**
  * A tree representing the content of a directory structures with subdirectories as the nodes
@@ -73,6 +122,153 @@ QDLLEXPORT bool operator<(const DirectoryTreeInformation &LHS, const DirectoryTr
  */
 typedef MyTree<FileTreeInformation, DirectoryTreeInformation> DirectoryTree;
 
+/**
+ * implicitly shared variant of DirectoryTree for speculative modifications
+ */
+typedef CowTree<FileTreeInformation, DirectoryTreeInformation> CowDirectoryTree;
+
+// allow both to be sorted with NaturalOrder
+inline const FileNameString &naturalKey(const FileTreeInformation &info) { return info.getName(); }
+inline const FileNameString &naturalKey(const DirectoryTreeInformation &info) { return info.name; }
+
+/**
+ * DirectoryTree that keeps files and directories in natural order ("part2" before "part10"),
+ * i.e. for display. Nodes can be looked up by FileNameString like in a DirectoryTree
+ */
+typedef MyTree<FileTreeInformation, DirectoryTreeInformation, NaturalOrder> NaturalDirectoryTree;
+
+
+/**
+ * @brief look up a file or directory by its path relative to a node, using the path index of
+ *        the tree (see MyTree::findPath)
+ *
+ * @param node the node the path is relative to
+ * @param path the path, components may be separated by slashes or backslashes
+ * @return the entry found. node is nullptr if the path doesn't exist
+ **/
+QDLLEXPORT DirectoryTree::PathEntry resolvePath(const DirectoryTree &node, const QString &path);
+
+/**
+ * @brief append a name to a path the way getFullPath joins them: separated by a backslash,
+ *        except for entries directly below the node the path starts at
+ *
+ * @param path the path built so far
+ * @param name the name of the file or directory to append
+ * @param topLevel true if name is an entry of the node the path starts at
+ **/
+QDLLEXPORT void appendPathComponent(QString &path, const FileNameString &name, bool topLevel);
+
+
+/**
+ * enumerates the full paths of all leafs below a node in a single depth-first walk. The paths
+ * are built up in a single buffer, so the cost is linear in the total length of the paths
+ * instead of calling getFullPath for every leaf.
+ * Usage:
+ *   for (DirectoryTreeLeafIterator iter(tree); iter.next();) {
+ *     use(iter.path(), iter.leaf());
+ *   }
+ * @note the tree must not be modified while iterating
+ */
+class QDLLEXPORT DirectoryTreeLeafIterator {
+public:
+  explicit DirectoryTreeLeafIterator(const DirectoryTree &tree);
+
+  /**
+   * @brief advance to the next leaf. This has to be called once before accessing the first leaf
+   * @return false if there are no more leafs
+   */
+  bool next();
+
+  /**
+   * @return full path of the current leaf, same as node().getFullPath(&leaf()). The reference is
+   *         only valid until the next call to next()
+   */
+  const QString &path() const { return m_Path; }
+
+  /**
+   * @return the current leaf
+   */
+  const FileTreeInformation &leaf() const { return *m_Leaf; }
+
+  /**
+   * @return the node containing the current leaf
+   */
+  const DirectoryTree &node() const { return *m_Stack.back().node; }
+
+private:
+  struct Frame {
+    const DirectoryTree *node;
+    DirectoryTree::const_leaf_iterator leaf;
+    DirectoryTree::const_node_iterator child;
+    int pathLength;
+  };
+
+  std::vector<Frame> m_Stack;
+  QString m_Path;
+  const FileTreeInformation *m_Leaf;
+};
+
+
+/**
+ * caches the full paths of nodes so the path of every node is only built once, from the cached
+ * path of its parent. This makes computing paths for many nodes and leafs linear in the total
+ * path length
+ * @note the cache has to be cleared when nodes are moved or renamed
+ */
+class QDLLEXPORT DirectoryTreePathCache {
+public:
+  /**
+   * @return full path of the node, same as node->getFullPath()
+   */
+  QString path(const DirectoryTree *node);
+
+  /**
+   * @return full path of a leaf of the node, same as node->getFullPath(&leaf)
+   */
+  QString path(const DirectoryTree *node, const FileTreeInformation &leaf);
+
+  /**
+   * @brief forget all cached paths
+   */
+  void clear() { m_Paths.clear(); }
+
+private:
+  std::unordered_map<const DirectoryTree*, QString> m_Paths;
+};
+
+
+/**
+ * an entry of a flat listing (i.e. the content of an archive) to build a DirectoryTree from
+ */
+struct DirectoryTreeEntry {
+  DirectoryTreeEntry() : path(), index(-1), isDirectory(false), size(0) { }
+  DirectoryTreeEntry(const QString &path, int index, bool isDirectory, quint64 size = 0)
+    : path(path), index(index), isDirectory(isDirectory), size(size) { }
+
+  // path relative to the tree root, components may be separated by slashes or backslashes
+  QString path;
+  int index;
+  bool isDirectory;
+  // size of a file in bytes, 0 if unknown
+  quint64 size;
+};
+
+
+/**
+ * @brief add a flat list of paths to a tree in one pass
+ *
+ * Directories are created as required, a directory entry only has to be part of the list if
+ * its index is relevant. Consecutive paths that share parent directories are inserted
+ * without searching for those directories again, so sorted input is processed fastest.
+ * Large listings are split up by top-level directory and built on multiple threads.
+ *
+ * @param tree the tree to add to. New nodes are allocated from the arena of this tree
+ * @param entries the entries to add. They can be in any order
+ * @param numThreads maximum number of threads to use. 0 uses one thread per core
+ **/
+QDLLEXPORT void buildDirectoryTree(DirectoryTree &tree, const std::vector<DirectoryTreeEntry> &entries,
+                                   unsigned int numThreads = 0);
+
 } // namespace MOBase
 
 #endif // DIRECTORYTREE_H
@@ -0,0 +1,132 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "directorytreediff.h"
+
+namespace MOBase {
+
+
+namespace {
+
+class DirectoryTreeDiffer {
+public:
+  DirectoryTreeDiffer(std::vector<DirectoryTreeDiffEntry> &result, bool includeUnchanged)
+    : m_Result(result), m_IncludeUnchanged(includeUnchanged)
+  {}
+
+  void diff(const DirectoryTree &oldNode, const DirectoryTree &newNode);
+
+private:
+  void addLeaf(DirectoryTreeDiffEntry::Change change,
+               const FileTreeInformation *oldLeaf, const FileTreeInformation *newLeaf);
+  void addNode(DirectoryTreeDiffEntry::Change change,
+               const DirectoryTree *oldNode, const DirectoryTree *newNode);
+
+private:
+  std::vector<DirectoryTreeDiffEntry> &m_Result;
+  bool m_IncludeUnchanged;
+  // path of the current entry, shared by all levels
+  QString m_Path;
+};
+
+
+void DirectoryTreeDiffer::diff(const DirectoryTree &oldNode, const DirectoryTree &newNode)
+{
+  int pathLength = m_Path.size();
+
+  // both leaf sets are sorted the same way, so they can be merged like sorted lists
+  auto oldLeaf = oldNode.leafsBegin();
+  auto newLeaf = newNode.leafsBegin();
+  while ((oldLeaf != oldNode.leafsEnd()) || (newLeaf != newNode.leafsEnd())) {
+    if ((newLeaf == newNode.leafsEnd())
+        || ((oldLeaf != oldNode.leafsEnd()) && (*oldLeaf < *newLeaf))) {
+      addLeaf(DirectoryTreeDiffEntry::Change::Removed, &*oldLeaf, nullptr);
+      ++oldLeaf;
+    } else if ((oldLeaf == oldNode.leafsEnd()) || (*newLeaf < *oldLeaf)) {
+      addLeaf(DirectoryTreeDiffEntry::Change::Added, nullptr, &*newLeaf);
+      ++newLeaf;
+    } else {
+      if (m_IncludeUnchanged) {
+        addLeaf(DirectoryTreeDiffEntry::Change::Unchanged, &*oldLeaf, &*newLeaf);
+      }
+      ++oldLeaf;
+      ++newLeaf;
+    }
+  }
+
+  auto oldChild = oldNode.nodesBegin();
+  auto newChild = newNode.nodesBegin();
+  while ((oldChild != oldNode.nodesEnd()) || (newChild != newNode.nodesEnd())) {
+    if ((newChild == newNode.nodesEnd())
+        || ((oldChild != oldNode.nodesEnd()) && ((*oldChild)->getData() < (*newChild)->getData()))) {
+      addNode(DirectoryTreeDiffEntry::Change::Removed, *oldChild, nullptr);
+      ++oldChild;
+    } else if ((oldChild == oldNode.nodesEnd()) || ((*newChild)->getData() < (*oldChild)->getData())) {
+      addNode(DirectoryTreeDiffEntry::Change::Added, nullptr, *newChild);
+      ++newChild;
+    } else {
+      appendPathComponent(m_Path, (*newChild)->getData().name, m_Path.isEmpty());
+      diff(**oldChild, **newChild);
+      m_Path.truncate(pathLength);
+      ++oldChild;
+      ++newChild;
+    }
+  }
+}
+
+
+void DirectoryTreeDiffer::addLeaf(DirectoryTreeDiffEntry::Change change,
+                                  const FileTreeInformation *oldLeaf,
+                                  const FileTreeInformation *newLeaf)
+{
+  int pathLength = m_Path.size();
+  appendPathComponent(m_Path, (newLeaf != nullptr) ? newLeaf->getName() : oldLeaf->getName(),
+                      m_Path.isEmpty());
+  DirectoryTreeDiffEntry entry = { change, m_Path, false, nullptr, nullptr, oldLeaf, newLeaf };
+  m_Result.push_back(entry);
+  m_Path.truncate(pathLength);
+}
+
+
+void DirectoryTreeDiffer::addNode(DirectoryTreeDiffEntry::Change change,
+                                  const DirectoryTree *oldNode, const DirectoryTree *newNode)
+{
+  int pathLength = m_Path.size();
+  appendPathComponent(m_Path, (newNode != nullptr) ? newNode->getData().name : oldNode->getData().name,
+                      m_Path.isEmpty());
+  DirectoryTreeDiffEntry entry = { change, m_Path, true, oldNode, newNode, nullptr, nullptr };
+  m_Result.push_back(entry);
+  m_Path.truncate(pathLength);
+}
+
+} // namespace
+
+
+std::vector<DirectoryTreeDiffEntry> diffDirectoryTrees(const DirectoryTree &oldTree,
+                                                       const DirectoryTree &newTree,
+                                                       bool includeUnchanged)
+{
+  std::vector<DirectoryTreeDiffEntry> result;
+  DirectoryTreeDiffer differ(result, includeUnchanged);
+  differ.diff(oldTree, newTree);
+  return result;
+}
+
+} // namespace MOBase
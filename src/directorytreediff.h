@@ -0,0 +1,83 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef DIRECTORYTREEDIFF_H
+#define DIRECTORYTREEDIFF_H
+
+#include "directorytree.h"
+#include "dllimport.h"
+
+#include <QString>
+
+#include <vector>
+
+namespace MOBase {
+
+/**
+ * one step of the edit script that turns one directory tree into another
+ */
+struct DirectoryTreeDiffEntry {
+
+  enum class Change {
+    // only in the new tree
+    Added,
+    // only in the old tree
+    Removed,
+    // in both trees. Only names are compared, this says nothing about file contents
+    Unchanged
+  };
+
+  Change change;
+  // path relative to the tree roots, using the spelling of the new tree where there is one
+  QString path;
+  bool isDirectory;
+
+  // the entry in the old and new tree, nullptr in the tree that doesn't contain it. For
+  // directories the node pointers are set, for files the leaf pointers
+  const DirectoryTree *oldNode;
+  const DirectoryTree *newNode;
+  const FileTreeInformation *oldLeaf;
+  const FileTreeInformation *newLeaf;
+};
+
+
+/**
+ * @brief compare two directory trees by walking their sorted leaf- and node-sets in lockstep.
+ *        The cost is linear in the size of the trees.
+ *
+ * The script is compact: a directory that exists in only one of the trees is reported as a
+ * single entry, its content is not listed. Directories that exist in both trees aren't reported
+ * themselves, only the changes inside them.
+ * Names are compared case-insensitively like everywhere else in the trees, so a file that only
+ * changed case counts as unchanged.
+ *
+ * @param oldTree the tree before the change
+ * @param newTree the tree after the change
+ * @param includeUnchanged if true, files present in both trees are reported as well
+ * @return the changes, in tree order. The pointers in the entries are valid as long as the
+ *         trees aren't modified
+ */
+QDLLEXPORT std::vector<DirectoryTreeDiffEntry> diffDirectoryTrees(const DirectoryTree &oldTree,
+                                                                  const DirectoryTree &newTree,
+                                                                  bool includeUnchanged = false);
+
+} // namespace MOBase
+
+#endif // DIRECTORYTREEDIFF_H
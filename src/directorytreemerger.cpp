@@ -0,0 +1,181 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "directorytreemerger.h"
+
+#include <algorithm>
+
+namespace MOBase {
+
+
+template <typename IteratorT>
+struct MergeCursor {
+  IteratorT current;
+  IteratorT end;
+};
+
+
+/**
+ * merges the sorted ranges of all cursors, calling visit once for every distinct element with
+ * the indices of all cursors currently pointing at an equivalent element
+ */
+template <typename IteratorT, typename LessT, typename VisitT>
+static void kWayMerge(std::vector<MergeCursor<IteratorT>> &cursors, LessT less, VisitT visit)
+{
+  // min-heap of cursor indices, ordered by the element they point to
+  auto greater = [&cursors, &less] (int lhs, int rhs) {
+    return less(*cursors[rhs].current, *cursors[lhs].current);
+  };
+
+  std::vector<int> heap;
+  for (int i = 0; i < static_cast<int>(cursors.size()); ++i) {
+    if (cursors[i].current != cursors[i].end) {
+      heap.push_back(i);
+    }
+  }
+  std::make_heap(heap.begin(), heap.end(), greater);
+
+  std::vector<int> group;
+  while (!heap.empty()) {
+    group.clear();
+    std::pop_heap(heap.begin(), heap.end(), greater);
+    group.push_back(heap.back());
+    heap.pop_back();
+    while (!heap.empty() && !less(*cursors[group.front()].current, *cursors[heap.front()].current)) {
+      std::pop_heap(heap.begin(), heap.end(), greater);
+      group.push_back(heap.back());
+      heap.pop_back();
+    }
+
+    // cursors are created in source order so sorting the group restores priority order
+    std::sort(group.begin(), group.end());
+    visit(group);
+
+    for (int index : group) {
+      if (++cursors[index].current != cursors[index].end) {
+        heap.push_back(index);
+        std::push_heap(heap.begin(), heap.end(), greater);
+      }
+    }
+  }
+}
+
+
+void DirectoryTreeMerger::merge(const std::vector<const DirectoryTree*> &trees)
+{
+  m_Files.clear();
+  m_Conflicts.clear();
+  m_ConflictFiles.clear();
+  m_ConflictEntries.clear();
+
+  std::vector<Source> sources;
+  for (int i = 0; i < static_cast<int>(trees.size()); ++i) {
+    if (trees[i] != nullptr) {
+      Source source = { i, trees[i] };
+      sources.push_back(source);
+    }
+  }
+
+  QString path;
+  mergeLevel(sources, path);
+
+  // group the conflicts by pair of trees so every pair gets one contiguous range of files
+  std::sort(m_ConflictEntries.begin(), m_ConflictEntries.end(),
+            [] (const ConflictEntry &lhs, const ConflictEntry &rhs) {
+              if (lhs.winner != rhs.winner) {
+                return lhs.winner < rhs.winner;
+              } else if (lhs.loser != rhs.loser) {
+                return lhs.loser < rhs.loser;
+              } else {
+                return lhs.file < rhs.file;
+              }
+            });
+
+  m_ConflictFiles.reserve(m_ConflictEntries.size());
+  for (const ConflictEntry &entry : m_ConflictEntries) {
+    if (m_Conflicts.empty()
+        || (m_Conflicts.back().winner != entry.winner)
+        || (m_Conflicts.back().loser != entry.loser)) {
+      Conflict conflict = { entry.winner, entry.loser, 0, static_cast<int>(m_ConflictFiles.size()) };
+      m_Conflicts.push_back(conflict);
+    }
+    ++m_Conflicts.back().count;
+    m_ConflictFiles.push_back(entry.file);
+  }
+  m_ConflictEntries.clear();
+  m_ConflictEntries.shrink_to_fit();
+}
+
+
+void DirectoryTreeMerger::mergeLevel(const std::vector<Source> &sources, QString &path)
+{
+  int pathLength = path.size();
+
+  // files
+  std::vector<MergeCursor<DirectoryTree::const_leaf_iterator>> leafCursors;
+  leafCursors.reserve(sources.size());
+  for (const Source &source : sources) {
+    MergeCursor<DirectoryTree::const_leaf_iterator> cursor = { source.node->leafsBegin(), source.node->leafsEnd() };
+    leafCursors.push_back(cursor);
+  }
+
+  kWayMerge(leafCursors,
+            [] (const FileTreeInformation &lhs, const FileTreeInformation &rhs) { return lhs < rhs; },
+            [&] (const std::vector<int> &group) {
+    int winner = group.back();
+    const FileTreeInformation &leaf = *leafCursors[winner].current;
+    path.truncate(pathLength);
+    appendPathComponent(path, leaf.getName(), path.isEmpty());
+
+    File file = { path, sources[winner].origin, leaf.getIndex() };
+    int fileIndex = static_cast<int>(m_Files.size());
+    m_Files.push_back(file);
+    for (std::size_t i = 0; i + 1 < group.size(); ++i) {
+      ConflictEntry conflict = { sources[winner].origin, sources[group[i]].origin, fileIndex };
+      m_ConflictEntries.push_back(conflict);
+    }
+  });
+
+  // directories
+  std::vector<MergeCursor<DirectoryTree::const_node_iterator>> nodeCursors;
+  nodeCursors.reserve(sources.size());
+  for (const Source &source : sources) {
+    MergeCursor<DirectoryTree::const_node_iterator> cursor = { source.node->nodesBegin(), source.node->nodesEnd() };
+    nodeCursors.push_back(cursor);
+  }
+
+  std::vector<Source> subSources;
+  kWayMerge(nodeCursors,
+            [] (const DirectoryTree *lhs, const DirectoryTree *rhs) { return lhs->getData() < rhs->getData(); },
+            [&] (const std::vector<int> &group) {
+    subSources.clear();
+    for (int index : group) {
+      Source source = { sources[index].origin, *nodeCursors[index].current };
+      subSources.push_back(source);
+    }
+    path.truncate(pathLength);
+    appendPathComponent(path, subSources.back().node->getData().name, path.isEmpty());
+    mergeLevel(subSources, path);
+  });
+
+  path.truncate(pathLength);
+}
+
+} // namespace MOBase
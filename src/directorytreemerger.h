@@ -0,0 +1,119 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef DIRECTORYTREEMERGER_H
+#define DIRECTORYTREEMERGER_H
+
+#include "directorytree.h"
+#include "dllimport.h"
+
+#include <QString>
+
+#include <vector>
+
+namespace MOBase {
+
+/**
+ * overlays any number of directory trees (i.e. one per mod) in a single pass and determines
+ * which tree provides each file and which trees conflict with each other.
+ * All trees are walked in parallel, merging the sorted leaf- and node-sets of each directory,
+ * so every entry is visited once instead of once per pairwise merge as with
+ * MyTree::addNode.
+ */
+class QDLLEXPORT DirectoryTreeMerger
+{
+public:
+
+  struct File {
+    // path relative to the tree roots
+    QString path;
+    // position of the tree providing the file in the list passed to merge
+    int origin;
+    // index of the leaf in that tree
+    std::size_t index;
+  };
+
+  struct Conflict {
+    // the tree whose file is used
+    int winner;
+    // the tree whose file is hidden
+    int loser;
+    // number of files of loser hidden by winner
+    int count;
+    // position of the first of these files in conflictFiles()
+    int firstFile;
+  };
+
+public:
+
+  /**
+   * @brief merge the trees
+   *
+   * @param trees the trees to merge in ascending priority, a file in a later tree overwrites
+   *              the same file in all trees before it
+   **/
+  void merge(const std::vector<const DirectoryTree*> &trees);
+
+  /**
+   * @return all files of the merged trees in tree order, each with the tree that wins it
+   **/
+  const std::vector<File> &files() const { return m_Files; }
+
+  /**
+   * @return one entry for every pair of trees that conflict, ordered by winner, then loser
+   **/
+  const std::vector<Conflict> &conflicts() const { return m_Conflicts; }
+
+  /**
+   * @return indices into files(). The files of each conflict are the range
+   *         [firstFile, firstFile + count)
+   **/
+  const std::vector<int> &conflictFiles() const { return m_ConflictFiles; }
+
+private:
+
+  struct Source {
+    int origin;
+    const DirectoryTree *node;
+  };
+
+  struct ConflictEntry {
+    int winner;
+    int loser;
+    int file;
+  };
+
+private:
+
+  void mergeLevel(const std::vector<Source> &sources, QString &path);
+
+private:
+
+  std::vector<File> m_Files;
+  std::vector<Conflict> m_Conflicts;
+  std::vector<int> m_ConflictFiles;
+
+  std::vector<ConflictEntry> m_ConflictEntries;
+
+};
+
+} // namespace MOBase
+
+#endif // DIRECTORYTREEMERGER_H
@@ -0,0 +1,338 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "directorytreequery.h"
+
+#include <algorithm>
+#include <utility>
+
+namespace MOBase {
+
+
+/**
+ * evaluates the compiled patterns of a query on a tree. At every node the walker knows the set
+ * of pattern positions reachable by the path leading to it, which makes this a simulation of
+ * the non-deterministic automaton formed by all patterns together
+ */
+class DirectoryTreeQuery::Walker {
+public:
+  Walker(const DirectoryTreeQuery &query, const std::function<bool(const Match&)> &callback)
+    : m_Query(query), m_Callback(callback), m_Count(0)
+  {}
+
+  /**
+   * @return false if the walk has to end
+   */
+  bool walk(const DirectoryTree &node, const std::vector<State> &states, int depth);
+
+  /**
+   * @brief add a state and everything reachable from it without consuming a directory
+   */
+  void addState(std::vector<State> &states, int pattern, int segment) const;
+
+private:
+  typedef std::pair<const DirectoryTree*, std::vector<State>> Step;
+
+  bool matchLeafs(const DirectoryTree &node, const std::vector<State> &states);
+  void stepAll(const DirectoryTree &node, const std::vector<State> &states, std::vector<Step> &steps) const;
+  void stepLiterals(const DirectoryTree &node, const std::vector<State> &states, std::vector<Step> &steps) const;
+
+private:
+  const DirectoryTreeQuery &m_Query;
+  const std::function<bool(const Match&)> &m_Callback;
+  std::size_t m_Count;
+  QString m_Path;
+};
+
+
+// the segment is case folded already, the name is compared by its key
+static bool matchesSegment(const QString &folded, bool wildcard, const FileNameString &name)
+{
+  const QChar *pattern = folded.constData();
+  const QChar *text = name.foldedData();
+  int patternLength = folded.size();
+  int textLength = name.size();
+
+  if (!wildcard) {
+    return (patternLength == textLength) && std::equal(pattern, pattern + patternLength, text);
+  }
+
+  // greedy matching, on a mismatch the most recent * takes one more character
+  int patternPos = 0;
+  int textPos = 0;
+  int starPos = -1;
+  int starTextPos = 0;
+  while (textPos < textLength) {
+    if ((patternPos < patternLength)
+        && ((pattern[patternPos] == QChar('?')) || (pattern[patternPos] == text[textPos]))) {
+      ++patternPos;
+      ++textPos;
+    } else if ((patternPos < patternLength) && (pattern[patternPos] == QChar('*'))) {
+      starPos = patternPos++;
+      starTextPos = textPos;
+    } else if (starPos >= 0) {
+      patternPos = starPos + 1;
+      textPos = ++starTextPos;
+    } else {
+      return false;
+    }
+  }
+  while ((patternPos < patternLength) && (pattern[patternPos] == QChar('*'))) {
+    ++patternPos;
+  }
+  return patternPos == patternLength;
+}
+
+
+void DirectoryTreeQuery::Walker::addState(std::vector<State> &states, int pattern, int segment) const
+{
+  const std::vector<Segment> &segments = m_Query.m_Patterns[pattern];
+  for (; segment < static_cast<int>(segments.size()); ++segment) {
+    auto iter = std::find_if(states.begin(), states.end(), [pattern, segment] (const State &state) {
+      return (state.pattern == pattern) && (state.segment == segment);
+    });
+    if (iter == states.end()) {
+      State state = { pattern, segment };
+      states.push_back(state);
+    }
+    // ** may match no directory at all, so the segment after it is reachable as well
+    if (segments[segment].type != Segment::AnyDepth) {
+      break;
+    }
+  }
+}
+
+
+bool DirectoryTreeQuery::Walker::walk(const DirectoryTree &node, const std::vector<State> &states, int depth)
+{
+  if (!matchLeafs(node, states)) {
+    return false;
+  }
+
+  if ((m_Query.m_MaxDepth >= 0) && (depth >= m_Query.m_MaxDepth)) {
+    return true;
+  }
+
+  bool literalsOnly = true;
+  bool anyStep = false;
+  for (const State &state : states) {
+    const std::vector<Segment> &segments = m_Query.m_Patterns[state.pattern];
+    const Segment &segment = segments[state.segment];
+    if (segment.type == Segment::AnyDepth) {
+      anyStep = true;
+      literalsOnly = false;
+    } else if (state.segment + 1 < static_cast<int>(segments.size())) {
+      // the last segment is matched against files only
+      anyStep = true;
+      literalsOnly = literalsOnly && (segment.type == Segment::Literal);
+    }
+  }
+  if (!anyStep) {
+    // no pattern can match anything below this node
+    return true;
+  }
+
+  std::vector<Step> steps;
+  if (literalsOnly) {
+    stepLiterals(node, states, steps);
+  } else {
+    stepAll(node, states, steps);
+  }
+
+  int pathLength = m_Path.size();
+  for (const Step &step : steps) {
+    if (m_Query.m_BuildPaths) {
+      appendPathComponent(m_Path, step.first->getData().name, m_Path.isEmpty());
+    }
+    if (!walk(*step.first, step.second, depth + 1)) {
+      return false;
+    }
+    m_Path.truncate(pathLength);
+  }
+  return true;
+}
+
+
+bool DirectoryTreeQuery::Walker::matchLeafs(const DirectoryTree &node, const std::vector<State> &states)
+{
+  // states that can match a file here, in pattern order so the first matching pattern wins
+  std::vector<State> leafStates;
+  for (const State &state : states) {
+    const std::vector<Segment> &segments = m_Query.m_Patterns[state.pattern];
+    if (state.segment + 1 == static_cast<int>(segments.size())) {
+      leafStates.push_back(state);
+    }
+  }
+  if (leafStates.empty()) {
+    return true;
+  }
+  std::sort(leafStates.begin(), leafStates.end(), [] (const State &lhs, const State &rhs) {
+    return lhs.pattern < rhs.pattern;
+  });
+
+  int pathLength = m_Path.size();
+  for (auto iter = node.leafsBegin(); iter != node.leafsEnd(); ++iter) {
+    const FileNameString &name = iter->getName();
+    for (const State &state : leafStates) {
+      const Segment &segment = m_Query.m_Patterns[state.pattern][state.segment];
+      if ((segment.type != Segment::AnyDepth)
+          && !matchesSegment(segment.folded, segment.type == Segment::Wildcard, name)) {
+        continue;
+      }
+      Match match = { state.pattern, &node, &*iter, QString() };
+      if (m_Query.m_BuildPaths) {
+        appendPathComponent(m_Path, iter->getName(), m_Path.isEmpty());
+        match.path = m_Path;
+        m_Path.truncate(pathLength);
+      }
+      ++m_Count;
+      if (!m_Callback(match)
+          || ((m_Query.m_Limit != 0) && (m_Count >= m_Query.m_Limit))) {
+        return false;
+      }
+      break;
+    }
+  }
+  return true;
+}
+
+
+void DirectoryTreeQuery::Walker::stepAll(const DirectoryTree &node, const std::vector<State> &states,
+                                         std::vector<Step> &steps) const
+{
+  for (auto iter = node.nodesBegin(); iter != node.nodesEnd(); ++iter) {
+    const FileNameString &name = (*iter)->getData().name;
+    std::vector<State> childStates;
+    for (const State &state : states) {
+      const std::vector<Segment> &segments = m_Query.m_Patterns[state.pattern];
+      const Segment &segment = segments[state.segment];
+      if (segment.type == Segment::AnyDepth) {
+        addState(childStates, state.pattern, state.segment);
+      } else if ((state.segment + 1 < static_cast<int>(segments.size()))
+                 && matchesSegment(segment.folded, segment.type == Segment::Wildcard, name)) {
+        addState(childStates, state.pattern, state.segment + 1);
+      }
+    }
+    if (!childStates.empty()) {
+      steps.push_back(Step(*iter, childStates));
+    }
+  }
+}
+
+
+void DirectoryTreeQuery::Walker::stepLiterals(const DirectoryTree &node, const std::vector<State> &states,
+                                              std::vector<Step> &steps) const
+{
+  for (const State &state : states) {
+    const std::vector<Segment> &segments = m_Query.m_Patterns[state.pattern];
+    if (state.segment + 1 >= static_cast<int>(segments.size())) {
+      continue;
+    }
+    auto iter = node.nodeFind(FileNameString(segments[state.segment].original));
+    if (iter == node.nodesEnd()) {
+      continue;
+    }
+    // several patterns may lead into the same directory
+    auto step = std::find_if(steps.begin(), steps.end(), [iter] (const Step &candidate) {
+      return candidate.first == *iter;
+    });
+    if (step == steps.end()) {
+      steps.push_back(Step(*iter, std::vector<State>()));
+      step = steps.end() - 1;
+    }
+    addState(step->second, state.pattern, state.segment + 1);
+  }
+
+  // visit in tree order, like stepAll
+  std::sort(steps.begin(), steps.end(), [] (const Step &lhs, const Step &rhs) {
+    return lhs.first->getData() < rhs.first->getData();
+  });
+}
+
+
+DirectoryTreeQuery::DirectoryTreeQuery()
+  : m_MaxDepth(-1)
+  , m_Limit(0)
+  , m_BuildPaths(false)
+{
+}
+
+
+int DirectoryTreeQuery::addPattern(const QString &pattern)
+{
+  std::vector<Segment> segments;
+  int start = 0;
+  for (int i = 0; i <= pattern.size(); ++i) {
+    if ((i < pattern.size()) && (pattern[i] != QChar('/')) && (pattern[i] != QChar('\\'))) {
+      continue;
+    }
+    QString text = pattern.mid(start, i - start);
+    start = i + 1;
+    if (text.isEmpty()) {
+      continue;
+    }
+
+    Segment segment;
+    if (text == QString("**")) {
+      // consecutive ** are the same as one
+      if (!segments.empty() && (segments.back().type == Segment::AnyDepth)) {
+        continue;
+      }
+      segment.type = Segment::AnyDepth;
+    } else if (text.contains(QChar('*')) || text.contains(QChar('?'))) {
+      segment.type = Segment::Wildcard;
+    } else {
+      segment.type = Segment::Literal;
+    }
+    segment.folded = text.toCaseFolded();
+    segment.original = text;
+    segments.push_back(segment);
+  }
+
+  m_Patterns.push_back(segments);
+  return static_cast<int>(m_Patterns.size()) - 1;
+}
+
+
+std::vector<DirectoryTreeQuery::Match> DirectoryTreeQuery::run(const DirectoryTree &tree) const
+{
+  std::vector<Match> result;
+  run(tree, [&result] (const Match &match) {
+    result.push_back(match);
+    return true;
+  });
+  return result;
+}
+
+
+bool DirectoryTreeQuery::run(const DirectoryTree &tree, const std::function<bool(const Match&)> &callback) const
+{
+  Walker walker(*this, callback);
+  std::vector<State> states;
+  for (int i = 0; i < static_cast<int>(m_Patterns.size()); ++i) {
+    walker.addState(states, i, 0);
+  }
+  if (states.empty()) {
+    return true;
+  }
+  return walker.walk(tree, states, 0);
+}
+
+} // namespace MOBase
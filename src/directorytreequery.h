@@ -0,0 +1,152 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef DIRECTORYTREEQUERY_H
+#define DIRECTORYTREEQUERY_H
+
+#include "directorytree.h"
+#include "dllimport.h"
+
+#include <QString>
+
+#include <functional>
+#include <vector>
+
+namespace MOBase {
+
+/**
+ * finds files in a DirectoryTree by glob patterns. Any number of patterns is evaluated in a
+ * single walk of the tree, subtrees no pattern can match in aren't entered.
+ *
+ * Patterns are paths relative to the root of the tree, separated by / or \. Matching is
+ * case-insensitive. Within a segment
+ *   *  matches any number of characters
+ *   ?  matches a single character
+ * A segment consisting of ** matches any number of directories, including none. The last
+ * segment is matched against file names, so
+ *   *.esp               matches plugins in the root directory
+ *   **\*.esp            matches plugins anywhere
+ *   meshes\**\*.nif     matches meshes anywhere below the meshes directory
+ *   textures\**         matches everything below the textures directory
+ * Segments without wildcards are looked up directly instead of being compared with every
+ * entry of a directory.
+ *
+ * Usage:
+ *   DirectoryTreeQuery query;
+ *   query.addPattern("*.esp");
+ *   query.addPattern("meshes\\**\\*.nif");
+ *   query.setLimit(1);
+ *   for (const DirectoryTreeQuery::Match &match : query.run(tree)) ...
+ */
+class QDLLEXPORT DirectoryTreeQuery
+{
+
+public:
+
+  struct Match {
+    // index of the pattern that matched, as returned by addPattern. If several patterns
+    // match the same file it is reported for the first of them only
+    int pattern;
+    const DirectoryTree *node;
+    const FileTreeInformation *leaf;
+    // full path of the file, same format as getFullPath. Empty unless paths are enabled
+    QString path;
+  };
+
+public:
+
+  DirectoryTreeQuery();
+
+  /**
+   * @brief compile a pattern and add it to the query
+   * @return index of the pattern, used to tell which pattern a file matched
+   */
+  int addPattern(const QString &pattern);
+
+  /**
+   * @brief only report files up to a depth. Files in the root of the tree are at depth 0
+   * @param depth the maximum depth, -1 for no limit (the default)
+   */
+  void setMaxDepth(int depth) { m_MaxDepth = depth; }
+
+  /**
+   * @brief stop after a number of matches
+   * @param limit maximum number of matches, 0 for no limit (the default)
+   */
+  void setLimit(std::size_t limit) { m_Limit = limit; }
+
+  /**
+   * @brief set whether the full paths of matches are determined. Disabled by default
+   */
+  void setBuildPaths(bool buildPaths) { m_BuildPaths = buildPaths; }
+
+  /**
+   * @brief evaluate the query
+   * @return all matches in tree order. The pointers are valid as long as the tree isn't
+   *         modified
+   */
+  std::vector<Match> run(const DirectoryTree &tree) const;
+
+  /**
+   * @brief evaluate the query, passing every match to a callback as it is found
+   * @param callback called for every match. Returning false ends the query
+   * @return false if the query was ended by the callback or the limit
+   */
+  bool run(const DirectoryTree &tree, const std::function<bool(const Match&)> &callback) const;
+
+private:
+
+  struct Segment {
+    enum Type {
+      // no wildcards, compared as a whole
+      Literal,
+      // contains * or ?
+      Wildcard,
+      // **
+      AnyDepth
+    };
+
+    Type type;
+    // case folded for comparisons
+    QString folded;
+    // as written, for direct lookups of literals
+    QString original;
+  };
+
+  // a position in a pattern: the next segment to match
+  struct State {
+    int pattern;
+    int segment;
+  };
+
+  class Walker;
+
+private:
+
+  std::vector<std::vector<Segment>> m_Patterns;
+  int m_MaxDepth;
+  std::size_t m_Limit;
+  bool m_BuildPaths;
+
+};
+
+} // namespace MOBase
+
+#endif // DIRECTORYTREEQUERY_H
@@ -0,0 +1,506 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "directorytreesnapshot.h"
+#include "safewritefile.h"
+#include "utility.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QHash>
+
+#include <cstring>
+#include <utility>
+#include <vector>
+
+namespace MOBase {
+
+
+static const char SnapshotMagic[4] = { 'M', 'O', 'D', 'T' };
+// has to be increased whenever the layout of the records changes
+static const quint32 SnapshotVersion = 2;
+// snapshots are stored in native byte order, this detects files from a different platform
+static const quint32 SnapshotByteOrder = 0x01020304;
+static const quint32 NoParent = 0xFFFFFFFF;
+
+
+// compares a name from the string table to the key of a FileNameString, in the same order
+// FileNameString uses. The name is folded on the fly
+static int compareToKey(const QChar *name, quint32 length, const FileNameString &key)
+{
+  const ushort *text = reinterpret_cast<const ushort*>(name);
+  const ushort *folded = reinterpret_cast<const ushort*>(key.foldedData());
+  quint32 keyLength = static_cast<quint32>(key.size());
+  quint32 pos = 0;
+  quint32 keyPos = 0;
+  while (pos < length) {
+    ushort units[2];
+    int count = 1;
+    uint value = text[pos++];
+    if (value < 0x80) {
+      units[0] = ((value >= 'A') && (value <= 'Z')) ? static_cast<ushort>(value + 0x20) : static_cast<ushort>(value);
+    } else {
+      if (QChar::isHighSurrogate(value) && (pos < length) && QChar::isLowSurrogate(text[pos])) {
+        value = QChar::surrogateToUcs4(static_cast<ushort>(value), text[pos++]);
+      }
+      value = QChar::toCaseFolded(value);
+      if (QChar::requiresSurrogates(value)) {
+        units[0] = QChar::highSurrogate(value);
+        units[1] = QChar::lowSurrogate(value);
+        count = 2;
+      } else {
+        units[0] = static_cast<ushort>(value);
+      }
+    }
+    for (int i = 0; i < count; ++i, ++keyPos) {
+      if (keyPos == keyLength) {
+        return 1;
+      } else if (units[i] != folded[keyPos]) {
+        return (units[i] < folded[keyPos]) ? -1 : 1;
+      }
+    }
+  }
+  return (keyPos < keyLength) ? -1 : 0;
+}
+
+
+struct DirectoryTreeSnapshot::Header {
+  char magic[4];
+  quint32 version;
+  quint32 byteOrder;
+  quint32 nodeCount;
+  quint32 leafCount;
+  // size of the string table in UTF-16 code units
+  quint32 stringLength;
+  qint64 sourceSize;
+  qint64 sourceModified;
+  quint32 sourcePathOffset;
+  quint32 sourcePathLength;
+};
+
+struct DirectoryTreeSnapshot::NodeRecord {
+  quint32 nameOffset;
+  quint32 nameLength;
+  qint32 index;
+  quint32 parent;
+  quint32 firstNode;
+  quint32 nodeCount;
+  quint32 firstLeaf;
+  quint32 leafCount;
+};
+
+struct DirectoryTreeSnapshot::LeafRecord {
+  quint32 nameOffset;
+  quint32 nameLength;
+  quint64 index;
+  quint64 size;
+};
+
+QString DirectoryTreeSnapshot::Leaf::name() const
+{
+  const LeafRecord &record = m_Snapshot->leafs()[m_Record];
+  return m_Snapshot->string(record.nameOffset, record.nameLength);
+}
+
+
+std::size_t DirectoryTreeSnapshot::Leaf::index() const
+{
+  return static_cast<std::size_t>(m_Snapshot->leafs()[m_Record].index);
+}
+
+
+quint64 DirectoryTreeSnapshot::Leaf::size() const
+{
+  return m_Snapshot->leafs()[m_Record].size;
+}
+
+
+QString DirectoryTreeSnapshot::Node::name() const
+{
+  const NodeRecord &record = m_Snapshot->nodes()[m_Record];
+  return m_Snapshot->string(record.nameOffset, record.nameLength);
+}
+
+
+int DirectoryTreeSnapshot::Node::index() const
+{
+  return m_Snapshot->nodes()[m_Record].index;
+}
+
+
+std::size_t DirectoryTreeSnapshot::Node::numNodes() const
+{
+  return m_Snapshot->nodes()[m_Record].nodeCount;
+}
+
+
+std::size_t DirectoryTreeSnapshot::Node::numLeafs() const
+{
+  return m_Snapshot->nodes()[m_Record].leafCount;
+}
+
+
+DirectoryTreeSnapshot::Node DirectoryTreeSnapshot::Node::node(std::size_t pos) const
+{
+  Q_ASSERT(pos < numNodes());
+  return Node(m_Snapshot, m_Snapshot->nodes()[m_Record].firstNode + static_cast<quint32>(pos));
+}
+
+
+DirectoryTreeSnapshot::Leaf DirectoryTreeSnapshot::Node::leaf(std::size_t pos) const
+{
+  Q_ASSERT(pos < numLeafs());
+  return Leaf(m_Snapshot, m_Snapshot->nodes()[m_Record].firstLeaf + static_cast<quint32>(pos));
+}
+
+
+std::size_t DirectoryTreeSnapshot::Node::findNode(const FileNameString &name) const
+{
+  const NodeRecord &record = m_Snapshot->nodes()[m_Record];
+  return m_Snapshot->find(m_Snapshot->nodes() + record.firstNode, record.nodeCount, name);
+}
+
+
+std::size_t DirectoryTreeSnapshot::Node::findLeaf(const FileNameString &name) const
+{
+  const NodeRecord &record = m_Snapshot->nodes()[m_Record];
+  return m_Snapshot->find(m_Snapshot->leafs() + record.firstLeaf, record.leafCount, name);
+}
+
+
+DirectoryTreeSnapshot::DirectoryTreeSnapshot()
+  : m_Data(nullptr)
+{
+}
+
+
+DirectoryTreeSnapshot::~DirectoryTreeSnapshot()
+{
+  unload();
+}
+
+
+DirectoryTreeSnapshot::Source DirectoryTreeSnapshot::sourceFor(const QString &fileName)
+{
+  QFileInfo info(fileName);
+  Source result = { info.absoluteFilePath(), info.size(), info.lastModified().toMSecsSinceEpoch() };
+  return result;
+}
+
+
+QByteArray DirectoryTreeSnapshot::serialize(const DirectoryTree &tree, const Source &source)
+{
+  std::vector<NodeRecord> nodes;
+  std::vector<LeafRecord> leafs;
+  QString strings;
+  QHash<QString, quint32> stringOffsets;
+
+  auto intern = [&strings, &stringOffsets] (const QString &value) -> quint32 {
+    auto iter = stringOffsets.find(value);
+    if (iter != stringOffsets.end()) {
+      return iter.value();
+    }
+    quint32 offset = static_cast<quint32>(strings.size());
+    strings.append(value);
+    stringOffsets.insert(value, offset);
+    return offset;
+  };
+
+  // breadth-first so the children of every node end up next to each other
+  std::vector<std::pair<const DirectoryTree*, quint32>> queue;
+  queue.push_back(std::make_pair(&tree, NoParent));
+  for (std::size_t i = 0; i < queue.size(); ++i) {
+    const DirectoryTree *node = queue[i].first;
+    QString name = node->getData().name.toQString();
+
+    NodeRecord record;
+    record.nameOffset = intern(name);
+    record.nameLength = static_cast<quint32>(name.size());
+    record.index = node->getData().index;
+    record.parent = queue[i].second;
+    record.firstNode = static_cast<quint32>(queue.size());
+    record.nodeCount = static_cast<quint32>(node->numNodes());
+    record.firstLeaf = static_cast<quint32>(leafs.size());
+    record.leafCount = static_cast<quint32>(node->numLeafs());
+    nodes.push_back(record);
+
+    for (auto iter = node->leafsBegin(); iter != node->leafsEnd(); ++iter) {
+      QString leafName = iter->getName().toQString();
+      LeafRecord leaf;
+      leaf.nameOffset = intern(leafName);
+      leaf.nameLength = static_cast<quint32>(leafName.size());
+      leaf.index = iter->getIndex();
+      leaf.size = iter->getSize();
+      leafs.push_back(leaf);
+    }
+    for (auto iter = node->nodesBegin(); iter != node->nodesEnd(); ++iter) {
+      queue.push_back(std::make_pair(*iter, static_cast<quint32>(i)));
+    }
+  }
+
+  Header header;
+  memcpy(header.magic, SnapshotMagic, sizeof(header.magic));
+  header.version = SnapshotVersion;
+  header.byteOrder = SnapshotByteOrder;
+  header.nodeCount = static_cast<quint32>(nodes.size());
+  header.leafCount = static_cast<quint32>(leafs.size());
+  header.sourceSize = source.size;
+  header.sourceModified = source.modified;
+  header.sourcePathOffset = intern(source.path);
+  header.sourcePathLength = static_cast<quint32>(source.path.size());
+  header.stringLength = static_cast<quint32>(strings.size());
+
+  QByteArray result;
+  result.reserve(static_cast<int>(sizeof(Header)
+                                  + nodes.size() * sizeof(NodeRecord)
+                                  + leafs.size() * sizeof(LeafRecord)
+                                  + strings.size() * sizeof(QChar)));
+  result.append(reinterpret_cast<const char*>(&header), sizeof(Header));
+  result.append(reinterpret_cast<const char*>(nodes.data()), static_cast<int>(nodes.size() * sizeof(NodeRecord)));
+  result.append(reinterpret_cast<const char*>(leafs.data()), static_cast<int>(leafs.size() * sizeof(LeafRecord)));
+  result.append(reinterpret_cast<const char*>(strings.constData()), static_cast<int>(strings.size() * sizeof(QChar)));
+  return result;
+}
+
+
+void DirectoryTreeSnapshot::save(const QString &fileName, const DirectoryTree &tree, const Source &source)
+{
+  QByteArray data = serialize(tree, source);
+  SafeWriteFile file(fileName);
+  if (file->write(data) != data.size()) {
+    throw MyException(QObject::tr("failed to write %1").arg(fileName));
+  }
+  file.commit();
+}
+
+
+void DirectoryTreeSnapshot::freeze(const DirectoryTree &tree)
+{
+  Source source = { QString(), 0, 0 };
+  if (!load(serialize(tree, source), source)) {
+    // serialize and attach disagree about the layout
+    throw MyException(QObject::tr("failed to freeze directory tree"));
+  }
+}
+
+
+bool DirectoryTreeSnapshot::load(const QString &fileName, const Source &source)
+{
+  unload();
+  m_File.setFileName(fileName);
+  if (!m_File.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  qint64 size = m_File.size();
+  const uchar *data = m_File.map(0, size);
+  if ((data == nullptr) || !attach(data, size, source)) {
+    unload();
+    return false;
+  }
+  return true;
+}
+
+
+bool DirectoryTreeSnapshot::load(const QByteArray &data, const Source &source)
+{
+  unload();
+  m_Buffer = data;
+  if (!attach(reinterpret_cast<const uchar*>(m_Buffer.constData()), m_Buffer.size(), source)) {
+    unload();
+    return false;
+  }
+  return true;
+}
+
+
+void DirectoryTreeSnapshot::unload()
+{
+  m_Data = nullptr;
+  m_Buffer.clear();
+  if (m_File.isOpen()) {
+    // this also unmaps the file
+    m_File.close();
+  }
+}
+
+
+bool DirectoryTreeSnapshot::attach(const uchar *data, qint64 size, const Source &source)
+{
+  // the records are read in place so their layout must not depend on the compiler
+  static_assert(sizeof(Header) == 48, "unexpected snapshot header size");
+  static_assert(sizeof(NodeRecord) == 32, "unexpected snapshot node size");
+  static_assert(sizeof(LeafRecord) == 24, "unexpected snapshot leaf size");
+
+  // everything is validated up front so the views and toTree don't have to check bounds. This
+  // only reads the records, nothing is copied
+  if ((size < static_cast<qint64>(sizeof(Header)))
+      || (reinterpret_cast<quintptr>(data) % alignof(Header) != 0)) {
+    return false;
+  }
+  const Header *head = reinterpret_cast<const Header*>(data);
+  if ((memcmp(head->magic, SnapshotMagic, sizeof(head->magic)) != 0)
+      || (head->version != SnapshotVersion)
+      || (head->byteOrder != SnapshotByteOrder)
+      || (head->nodeCount == 0)) {
+    return false;
+  }
+  qint64 expectedSize = static_cast<qint64>(sizeof(Header))
+                      + static_cast<qint64>(head->nodeCount) * sizeof(NodeRecord)
+                      + static_cast<qint64>(head->leafCount) * sizeof(LeafRecord)
+                      + static_cast<qint64>(head->stringLength) * sizeof(QChar);
+  if (expectedSize != size) {
+    return false;
+  }
+
+  auto validString = [head] (quint32 offset, quint32 length) {
+    return static_cast<quint64>(offset) + length <= head->stringLength;
+  };
+
+  if (!validString(head->sourcePathOffset, head->sourcePathLength)) {
+    return false;
+  }
+
+  const NodeRecord *nodeRecords = reinterpret_cast<const NodeRecord*>(head + 1);
+  const LeafRecord *leafRecords = reinterpret_cast<const LeafRecord*>(nodeRecords + head->nodeCount);
+  const QChar *stringTable = reinterpret_cast<const QChar*>(leafRecords + head->leafCount);
+
+  // children and leafs have to be laid out exactly as serialize does it. Apart from the bounds
+  // this guarantees every node has exactly one parent, so walking the snapshot terminates
+  quint64 nextNode = 1;
+  quint64 nextLeaf = 0;
+  for (quint32 i = 0; i < head->nodeCount; ++i) {
+    const NodeRecord &node = nodeRecords[i];
+    if (!validString(node.nameOffset, node.nameLength)
+        || (node.firstNode != nextNode)
+        || (node.firstLeaf != nextLeaf)) {
+      return false;
+    }
+    nextNode += node.nodeCount;
+    nextLeaf += node.leafCount;
+  }
+  if ((nextNode != head->nodeCount) || (nextLeaf != head->leafCount)) {
+    return false;
+  }
+  for (quint32 i = 0; i < head->leafCount; ++i) {
+    if (!validString(leafRecords[i].nameOffset, leafRecords[i].nameLength)) {
+      return false;
+    }
+  }
+
+  QString sourcePath = QString::fromRawData(stringTable + head->sourcePathOffset,
+                                            static_cast<int>(head->sourcePathLength));
+  if ((sourcePath.compare(source.path, Qt::CaseInsensitive) != 0)
+      || (head->sourceSize != source.size)
+      || (head->sourceModified != source.modified)) {
+    return false;
+  }
+
+  m_Data = data;
+  return true;
+}
+
+
+DirectoryTreeSnapshot::Node DirectoryTreeSnapshot::root() const
+{
+  Q_ASSERT(isValid());
+  return Node(this, 0);
+}
+
+
+DirectoryTree *DirectoryTreeSnapshot::toTree(const std::shared_ptr<TreeArena> &arena) const
+{
+  Q_ASSERT(isValid());
+  DirectoryTree *result = new (arena) DirectoryTree(arena);
+  fillTree(*result, 0);
+  return result;
+}
+
+
+void DirectoryTreeSnapshot::fillTree(DirectoryTree &tree, quint32 record) const
+{
+  // names are copied here, the tree has to outlive the snapshot
+  const NodeRecord &node = nodes()[record];
+  tree.setData(DirectoryTreeInformation(QString(strings() + node.nameOffset, static_cast<int>(node.nameLength)),
+                                        node.index));
+  for (quint32 i = node.firstLeaf; i < node.firstLeaf + node.leafCount; ++i) {
+    const LeafRecord &leaf = leafs()[i];
+    tree.addLeaf(FileTreeInformation(QString(strings() + leaf.nameOffset, static_cast<int>(leaf.nameLength)),
+                                     static_cast<std::size_t>(leaf.index), leaf.size));
+  }
+  for (quint32 i = node.firstNode; i < node.firstNode + node.nodeCount; ++i) {
+    DirectoryTree *subTree = tree.createNode();
+    fillTree(*subTree, i);
+    tree.addNode(subTree, false);
+  }
+}
+
+
+QString DirectoryTreeSnapshot::string(quint32 offset, quint32 length) const
+{
+  return QString::fromRawData(strings() + offset, static_cast<int>(length));
+}
+
+
+template <typename RecordT>
+std::size_t DirectoryTreeSnapshot::find(const RecordT *records, quint32 count, const FileNameString &name) const
+{
+  // records are in the order of the tree they were created from
+  quint32 first = 0;
+  while (count > 0) {
+    quint32 half = count / 2;
+    const RecordT &record = records[first + half];
+    int result = compareToKey(strings() + record.nameOffset, record.nameLength, name);
+    if (result == 0) {
+      return first + half;
+    } else if (result < 0) {
+      first += half + 1;
+      count -= half + 1;
+    } else {
+      count = half;
+    }
+  }
+  return Node::npos;
+}
+
+
+const DirectoryTreeSnapshot::Header *DirectoryTreeSnapshot::header() const
+{
+  return reinterpret_cast<const Header*>(m_Data);
+}
+
+
+const DirectoryTreeSnapshot::NodeRecord *DirectoryTreeSnapshot::nodes() const
+{
+  return reinterpret_cast<const NodeRecord*>(header() + 1);
+}
+
+
+const DirectoryTreeSnapshot::LeafRecord *DirectoryTreeSnapshot::leafs() const
+{
+  return reinterpret_cast<const LeafRecord*>(nodes() + header()->nodeCount);
+}
+
+
+const QChar *DirectoryTreeSnapshot::strings() const
+{
+  return reinterpret_cast<const QChar*>(leafs() + header()->leafCount);
+}
+
+} // namespace MOBase
@@ -0,0 +1,228 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef DIRECTORYTREESNAPSHOT_H
+#define DIRECTORYTREESNAPSHOT_H
+
+#include "directorytree.h"
+#include "dllimport.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#include <memory>
+
+namespace MOBase {
+
+/**
+ * a read-only, binary image of a DirectoryTree that can be written to disk and mapped back
+ * into memory without parsing. This is meant to cache archive listings and directory scans
+ * between sessions.
+ *
+ * The file consists of a header, an array of node records, an array of leaf records and a
+ * table of UTF-16 names (without terminators), all in native byte order:
+ * - nodes are stored breadth-first with the root first, so the children of each node form a
+ *   contiguous range of the node array. The same holds for the leafs of each node.
+ * - children and leafs of a node are stored in the order of the tree they were created from,
+ *   so they are sorted case-insensitively by name
+ * - each name is stored once, records refer to it by offset and length
+ *
+ * A snapshot is keyed by the path, size and modification time of whatever it was created
+ * from, loading fails if those don't match.
+ *
+ * The same layout serves as a frozen, in-memory form of a tree that is only read once it has
+ * been built (see freeze). Leafs take 24 bytes and nodes 32 bytes plus their names, compared
+ * to several allocations per entry in a DirectoryTree, and entries are found by binary search.
+ **/
+class QDLLEXPORT DirectoryTreeSnapshot
+{
+
+public:
+
+  /**
+   * identifies the origin of a snapshot
+   **/
+  struct Source {
+    QString path;
+    qint64 size;
+    // modification time in milliseconds since the epoch
+    qint64 modified;
+  };
+
+  class Node;
+
+  /**
+   * view of a leaf in a snapshot. This is only valid as long as the snapshot is loaded
+   **/
+  class Leaf {
+    friend class Node;
+  public:
+    /**
+     * @return name of the leaf. The string refers to the snapshot memory directly
+     **/
+    QString name() const;
+    std::size_t index() const;
+    quint64 size() const;
+  private:
+    Leaf(const DirectoryTreeSnapshot *snapshot, quint32 record) : m_Snapshot(snapshot), m_Record(record) {}
+    const DirectoryTreeSnapshot *m_Snapshot;
+    quint32 m_Record;
+  };
+
+  /**
+   * view of a node in a snapshot. This is only valid as long as the snapshot is loaded
+   **/
+  class Node {
+    friend class DirectoryTreeSnapshot;
+  public:
+    // returned by findNode and findLeaf if there is no match
+    static const std::size_t npos = static_cast<std::size_t>(-1);
+  public:
+    /**
+     * @return name of the node. The string refers to the snapshot memory directly
+     **/
+    QString name() const;
+    int index() const;
+    std::size_t numNodes() const;
+    std::size_t numLeafs() const;
+    Node node(std::size_t pos) const;
+    Leaf leaf(std::size_t pos) const;
+
+    /**
+     * @brief find a sub-node by name (case-insensitive) using binary search
+     * @return position of the sub-node, to be passed to node(), or npos
+     **/
+    std::size_t findNode(const FileNameString &name) const;
+
+    /**
+     * @brief find a leaf by name (case-insensitive) using binary search
+     * @return position of the leaf, to be passed to leaf(), or npos
+     **/
+    std::size_t findLeaf(const FileNameString &name) const;
+  private:
+    Node(const DirectoryTreeSnapshot *snapshot, quint32 record) : m_Snapshot(snapshot), m_Record(record) {}
+    const DirectoryTreeSnapshot *m_Snapshot;
+    quint32 m_Record;
+  };
+
+public:
+
+  DirectoryTreeSnapshot();
+  ~DirectoryTreeSnapshot();
+
+  /**
+   * @brief determine the source key of a file or directory from the file system
+   **/
+  static Source sourceFor(const QString &fileName);
+
+  /**
+   * @brief create the binary image of a tree
+   * @param tree the tree to store
+   * @param source key of the tree
+   * @return the image, this is what save writes to disk
+   **/
+  static QByteArray serialize(const DirectoryTree &tree, const Source &source);
+
+  /**
+   * @brief replace the content with a frozen copy of a tree. The copy doesn't depend on the tree
+   *        and has no source, it can't be used with load
+   **/
+  void freeze(const DirectoryTree &tree);
+
+  /**
+   * @brief write the binary image of a tree to disk
+   * @throws MyException if the file can't be written
+   **/
+  static void save(const QString &fileName, const DirectoryTree &tree, const Source &source);
+
+  /**
+   * @brief map a snapshot file into memory. The file stays open until the snapshot is
+   *        unloaded
+   * @param fileName path of the snapshot
+   * @param source the expected key
+   * @return true on success. false if the file doesn't exist, is damaged, was written by an
+   *         incompatible version or belongs to a different source. Nothing is loaded in that
+   *         case
+   **/
+  bool load(const QString &fileName, const Source &source);
+
+  /**
+   * @brief use an image in memory as created by serialize
+   * @return see load
+   **/
+  bool load(const QByteArray &data, const Source &source);
+
+  /**
+   * @brief release the loaded snapshot. All views are invalidated
+   **/
+  void unload();
+
+  /**
+   * @return true if a snapshot is loaded
+   **/
+  bool isValid() const { return m_Data != nullptr; }
+
+  /**
+   * @return the root node of the snapshot. A snapshot has to be loaded
+   **/
+  Node root() const;
+
+  /**
+   * @brief create a regular tree from the snapshot
+   * @param arena arena to allocate the new tree from. If this is empty the tree is allocated
+   *              on the heap
+   * @return a new tree, the caller takes custody
+   **/
+  DirectoryTree *toTree(const std::shared_ptr<TreeArena> &arena = std::shared_ptr<TreeArena>()) const;
+
+private:
+
+  struct Header;
+  struct NodeRecord;
+  struct LeafRecord;
+
+private:
+
+  DirectoryTreeSnapshot(const DirectoryTreeSnapshot&);
+  DirectoryTreeSnapshot &operator=(const DirectoryTreeSnapshot&);
+
+  bool attach(const uchar *data, qint64 size, const Source &source);
+  QString string(quint32 offset, quint32 length) const;
+  template <typename RecordT>
+  std::size_t find(const RecordT *records, quint32 count, const FileNameString &name) const;
+  void fillTree(DirectoryTree &tree, quint32 record) const;
+
+  const Header *header() const;
+  const NodeRecord *nodes() const;
+  const LeafRecord *leafs() const;
+  const QChar *strings() const;
+
+private:
+
+  QFile m_File;
+  QByteArray m_Buffer;
+  const uchar *m_Data;
+
+};
+
+} // namespace MOBase
+
+#endif // DIRECTORYTREESNAPSHOT_H
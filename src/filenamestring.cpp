@@ -1,17 +1,406 @@
 #include "filenamestring.h"
 
+#include <algorithm>
+#include <cstddef>
+#include <new>
+
+//SSE2 is part of every x64 cpu and is enabled by default for 32 bit builds with
+//current compilers. AVX2 is only used after checking the cpu at runtime
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define FILENAMESTRING_SSE2
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FILENAMESTRING_AVX2
+#define FILENAMESTRING_TARGET_AVX2
+#elif defined(__GNUC__)
+#include <cpuid.h>
+#define FILENAMESTRING_AVX2
+#define FILENAMESTRING_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
 namespace MOBase {
 
+namespace {
+
+//Almost all names are pure ASCII. The vector kernels below handle ASCII blocks
+//and stop at the first block containing anything else, the scalar code does the
+//full unicode folding from there on.
+
+//Returns the length of the leading part of both strings that is pure ASCII and
+//equal ignoring case. May stop early, the result is only a lower bound
+typedef int (*AsciiPrefixFunc)(ushort const *lhs, ushort const *rhs, int length);
+
+//Lowercases the leading pure ASCII part of source into target and returns its
+//length. May stop early as well
+typedef int (*AsciiFoldFunc)(ushort const *source, ushort *target, int length);
+
+#ifndef FILENAMESTRING_SSE2
+
+int asciiPrefixScalar(ushort const *, ushort const *, int)
+{
+  return 0;
+}
+
+int asciiFoldScalar(ushort const *, ushort *, int)
+{
+  return 0;
+}
+
+int mismatchScalar(ushort const *, ushort const *, int)
+{
+  return 0;
+}
+
+#else
+
+inline __m128i toLowerSse2(__m128i value)
+{
+  __m128i upper = _mm_and_si128(_mm_cmpgt_epi16(value, _mm_set1_epi16('A' - 1)),
+                                _mm_cmplt_epi16(value, _mm_set1_epi16('Z' + 1)));
+  return _mm_or_si128(value, _mm_and_si128(upper, _mm_set1_epi16(0x20)));
+}
+
+inline bool isAsciiSse2(__m128i value)
+{
+  __m128i high = _mm_and_si128(value, _mm_set1_epi16(static_cast<short>(0xFF80)));
+  return _mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xFFFF;
+}
+
+int asciiPrefixSse2(ushort const *lhs, ushort const *rhs, int length)
+{
+  int pos = 0;
+  for (; pos + 8 <= length; pos += 8) {
+    __m128i left = _mm_loadu_si128(reinterpret_cast<__m128i const*>(lhs + pos));
+    __m128i right = _mm_loadu_si128(reinterpret_cast<__m128i const*>(rhs + pos));
+    if (!isAsciiSse2(_mm_or_si128(left, right))) {
+      break;
+    }
+    __m128i equal = _mm_cmpeq_epi16(toLowerSse2(left), toLowerSse2(right));
+    if (_mm_movemask_epi8(equal) != 0xFFFF) {
+      break;
+    }
+  }
+  return pos;
+}
+
+int asciiFoldSse2(ushort const *source, ushort *target, int length)
+{
+  int pos = 0;
+  for (; pos + 8 <= length; pos += 8) {
+    __m128i value = _mm_loadu_si128(reinterpret_cast<__m128i const*>(source + pos));
+    if (!isAsciiSse2(value)) {
+      break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(target + pos), toLowerSse2(value));
+  }
+  return pos;
+}
+
+int mismatchSse2(ushort const *lhs, ushort const *rhs, int length)
+{
+  int pos = 0;
+  for (; pos + 8 <= length; pos += 8) {
+    __m128i left = _mm_loadu_si128(reinterpret_cast<__m128i const*>(lhs + pos));
+    __m128i right = _mm_loadu_si128(reinterpret_cast<__m128i const*>(rhs + pos));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(left, right)) != 0xFFFF) {
+      break;
+    }
+  }
+  return pos;
+}
+
+#endif // FILENAMESTRING_SSE2
+
+#ifdef FILENAMESTRING_AVX2
+
+FILENAMESTRING_TARGET_AVX2
+inline __m256i toLowerAvx2(__m256i value)
+{
+  __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi16(value, _mm256_set1_epi16('A' - 1)),
+                                   _mm256_cmpgt_epi16(_mm256_set1_epi16('Z' + 1), value));
+  return _mm256_or_si256(value, _mm256_and_si256(upper, _mm256_set1_epi16(0x20)));
+}
+
+FILENAMESTRING_TARGET_AVX2
+inline bool isAsciiAvx2(__m256i value)
+{
+  return _mm256_testz_si256(value, _mm256_set1_epi16(static_cast<short>(0xFF80))) != 0;
+}
+
+FILENAMESTRING_TARGET_AVX2
+int asciiPrefixAvx2(ushort const *lhs, ushort const *rhs, int length)
+{
+  int pos = 0;
+  for (; pos + 16 <= length; pos += 16) {
+    __m256i left = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(lhs + pos));
+    __m256i right = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(rhs + pos));
+    if (!isAsciiAvx2(_mm256_or_si256(left, right))) {
+      return pos;
+    }
+    __m256i equal = _mm256_cmpeq_epi16(toLowerAvx2(left), toLowerAvx2(right));
+    if (static_cast<unsigned int>(_mm256_movemask_epi8(equal)) != 0xFFFFFFFFU) {
+      return pos;
+    }
+  }
+  //Most names are shorter than 16 characters, let SSE2 have a go at the rest
+  return pos + asciiPrefixSse2(lhs + pos, rhs + pos, length - pos);
+}
+
+FILENAMESTRING_TARGET_AVX2
+int asciiFoldAvx2(ushort const *source, ushort *target, int length)
+{
+  int pos = 0;
+  for (; pos + 16 <= length; pos += 16) {
+    __m256i value = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(source + pos));
+    if (!isAsciiAvx2(value)) {
+      return pos;
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + pos), toLowerAvx2(value));
+  }
+  return pos + asciiFoldSse2(source + pos, target + pos, length - pos);
+}
+
+bool cpuSupportsAvx2()
+{
+#if defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  __cpuid(info, 1);
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+  //The OS has to save the ymm registers on context switches
+  if (!osxsave || !avx || ((_xgetbv(0) & 0x6) != 0x6)) {
+    return false;
+  }
+  __cpuidex(info, 7, 0);
+  return (info[1] & (1 << 5)) != 0;
+#else
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // FILENAMESTRING_AVX2
+
+AsciiPrefixFunc selectAsciiPrefix()
+{
+#if defined(FILENAMESTRING_AVX2)
+  if (cpuSupportsAvx2()) {
+    return &asciiPrefixAvx2;
+  }
+#endif
+#if defined(FILENAMESTRING_SSE2)
+  return &asciiPrefixSse2;
+#else
+  return &asciiPrefixScalar;
+#endif
+}
+
+AsciiFoldFunc selectAsciiFold()
+{
+#if defined(FILENAMESTRING_AVX2)
+  if (cpuSupportsAvx2()) {
+    return &asciiFoldAvx2;
+  }
+#endif
+#if defined(FILENAMESTRING_SSE2)
+  return &asciiFoldSse2;
+#else
+  return &asciiFoldScalar;
+#endif
+}
+
+AsciiPrefixFunc const asciiPrefix = selectAsciiPrefix();
+AsciiFoldFunc const asciiFold = selectAsciiFold();
+
+//Position of the first unit that differs, or length. The keys aren't QStrings
+//so there is nothing to hand them to
+int mismatch(ushort const *lhs, ushort const *rhs, int length)
+{
+#if defined(FILENAMESTRING_SSE2)
+  int pos = mismatchSse2(lhs, rhs, length);
+#else
+  int pos = mismatchScalar(lhs, rhs, length);
+#endif
+  while ((pos < length) && (lhs[pos] == rhs[pos])) {
+    ++pos;
+  }
+  return pos;
+}
+
+//Reads the code point at pos, advances pos and returns it case folded
+uint foldedCodePoint(ushort const *data, int length, int &pos)
+{
+  uint ucs4 = data[pos++];
+  if (QChar::isHighSurrogate(ucs4) && (pos < length) && QChar::isLowSurrogate(data[pos])) {
+    ucs4 = QChar::surrogateToUcs4(static_cast<ushort>(ucs4), data[pos++]);
+  }
+  return QChar::toCaseFolded(ucs4);
+}
+
+//Case insensitive comparison of two ranges of the same length, same semantics
+//as QString::compare with Qt::CaseInsensitive
+bool equalCaseInsensitive(QChar const *lhs, QChar const *rhs, int length)
+{
+  ushort const *left = reinterpret_cast<ushort const*>(lhs);
+  ushort const *right = reinterpret_cast<ushort const*>(rhs);
+  int leftPos = asciiPrefix(left, right, length);
+  int rightPos = leftPos;
+  while ((leftPos < length) && (rightPos < length)) {
+    if (foldedCodePoint(left, length, leftPos) != foldedCodePoint(right, length, rightPos)) {
+      return false;
+    }
+  }
+  return (leftPos == length) && (rightPos == length);
+}
+
+//Length of the leading part folding doesn't change
+int firstChange(ushort const *source, int length)
+{
+  int pos = 0;
+  while ((pos < length) && (source[pos] < 0x80) && ((source[pos] < 'A') || (source[pos] > 'Z'))) {
+    ++pos;
+  }
+  return pos;
+}
+
+//Folds name into target, which has room for its length. The first start units
+//are known to be unchanged. Returns false if the folded name has a different
+//length, which Qt's simple case folding shouldn't produce
+bool foldInto(QString const &name, int start, ushort *target)
+{
+  int length = name.size();
+  ushort const *source = name.utf16();
+  std::copy(source, source + start, target);
+  int pos = start + asciiFold(source + start, target + start, length - start);
+  for (; pos < length; ++pos) {
+    ushort value = source[pos];
+    if (value >= 0x80) {
+      //Leave the rest, including surrogate pairs, to Qt
+      QString rest = name.mid(pos).toCaseFolded();
+      if (rest.size() != length - pos) {
+        return false;
+      }
+      std::copy(rest.utf16(), rest.utf16() + rest.size(), target + pos);
+      return true;
+    }
+    target[pos] = ((value >= 'A') && (value <= 'Z')) ? static_cast<ushort>(value + 0x20) : value;
+  }
+  return true;
+}
+
+uint hashKey(ushort const *key, int length)
+{
+  return qHashBits(key, length * sizeof(ushort));
+}
+
+}
+
+void FileNameString::assign(QString const &name)
+{
+  int length = name.size();
+  if (length == 0) {
+    return;
+  }
+  ushort const *source = name.utf16();
+  int changed = firstChange(source, length);
+
+  if (length <= InlineCapacity) {
+    std::copy(source, source + length, m_Inline);
+    m_InlineSize = static_cast<unsigned char>(length);
+    if (changed == length) {
+      m_Storage = Inline;
+      m_Hash = hashKey(m_Inline, length);
+      return;
+    }
+    if ((2 * length <= InlineCapacity) && foldInto(name, changed, m_Inline + length)) {
+      m_Storage = InlineFolded;
+      m_Hash = hashKey(m_Inline + length, length);
+      return;
+    }
+  }
+
+  bool separateKey = (changed != length);
+  std::size_t bytes = offsetof(Data, text) + (separateKey ? 2 : 1) * length * sizeof(ushort);
+  Data *data = new (::operator new(bytes)) Data;
+  data->ref.store(1, std::memory_order_relaxed);
+  data->size = length;
+  data->separateKey = separateKey;
+  std::copy(source, source + length, data->text);
+
+  ushort *key = data->text;
+  if (separateKey) {
+    key += length;
+    if (!foldInto(name, changed, key)) {
+      QString folded = name.toCaseFolded();
+      Q_ASSERT(folded.size() == length);
+      std::copy(folded.utf16(), folded.utf16() + length, key);
+    }
+  }
+  m_Shared = data;
+  m_Storage = Shared;
+  m_InlineSize = 0;
+  m_Hash = hashKey(key, length);
+}
+
+void FileNameString::destroy()
+{
+  m_Shared->~Data();
+  ::operator delete(m_Shared);
+}
+
+bool FileNameString::startsWith(QString const &with) const
+{
+  return (with.size() <= size())
+      && equalCaseInsensitive(constData(), with.constData(), with.size());
+}
+
+bool FileNameString::endsWith(QString const &with) const
+{
+  return (with.size() <= size())
+      && equalCaseInsensitive(constData() + size() - with.size(), with.constData(), with.size());
+}
+
 bool operator<(FileNameString const &lhs, FileNameString const &rhs)
 {
-  //FIXME This might not be appropriate? should do a localecompare?
-  return lhs.m_Name.compare(rhs.m_Name, Qt::CaseInsensitive) < 0;
+  //Both keys are folded already so this is a plain comparison of UTF-16 code units
+  ushort const *left = reinterpret_cast<ushort const*>(lhs.foldedData());
+  ushort const *right = reinterpret_cast<ushort const*>(rhs.foldedData());
+  int common = std::min(lhs.size(), rhs.size());
+  int pos = mismatch(left, right, common);
+  if (pos < common) {
+    return left[pos] < right[pos];
+  }
+  return lhs.size() < rhs.size();
 }
 
 bool operator==(FileNameString const &lhs, QString const &rhs)
 {
   //FIXME This might not be appropriate? should do a localecompare?
-  return lhs.m_Name.compare(rhs, Qt::CaseInsensitive) == 0;
+  return (lhs.size() == rhs.size())
+      && equalCaseInsensitive(lhs.constData(), rhs.constData(), rhs.size());
+}
+
+bool operator==(FileNameString const &lhs, FileNameString const &rhs)
+{
+  int length = lhs.size();
+  if ((lhs.m_Storage == FileNameString::Shared) && (rhs.m_Storage == FileNameString::Shared)
+      && (lhs.m_Shared == rhs.m_Shared)) {
+    return true;
+  }
+  return (lhs.m_Hash == rhs.m_Hash) && (length == rhs.size())
+      && (mismatch(reinterpret_cast<ushort const*>(lhs.foldedData()),
+                   reinterpret_cast<ushort const*>(rhs.foldedData()), length) == length);
+}
+
+uint qHash(FileNameString const &name, uint seed)
+{
+  return name.m_Hash ^ seed;
 }
 
 }
@@ -3,8 +3,13 @@
 
 #include "dllimport.h"
 
+#include <QHash>
 #include <QString>
 
+#include <atomic>
+#include <cstring>
+#include <functional>
+
 namespace MOBase {
 
 /** This class wraps up a QString so the only comparisons are case insensitive
@@ -16,60 +21,211 @@ namespace MOBase {
 class FileNameString {
   friend QDLLEXPORT bool operator<(FileNameString const &lhs, FileNameString const &rhs);
   friend QDLLEXPORT bool operator==(FileNameString const &lhs, QString const &rhs);
+  friend QDLLEXPORT bool operator==(FileNameString const &lhs, FileNameString const &rhs);
+  friend QDLLEXPORT uint qHash(FileNameString const &name, uint seed);
 
  public:
-  FileNameString()
+  FileNameString() :
+    m_Hash(0), m_InlineSize(0), m_Storage(Inline)
   {}
 
   //Good styling says this should really be explicit, but not sure how many places
   //this would break.
   /*explicit */FileNameString(QString const &m_Name) :
-    m_Name(m_Name)
-  {}
+    m_Hash(0), m_InlineSize(0), m_Storage(Inline)
+  {
+    assign(m_Name);
+  }
 
   //Should be explicit but it makes initialising std::set<FileNameString> tedious
   FileNameString(char const *m_Name) :
-    m_Name(m_Name)
-  {}
+    m_Hash(0), m_InlineSize(0), m_Storage(Inline)
+  {
+    assign(QString(m_Name));
+  }
 
   FileNameString(FileNameString const &other) :
-    m_Name(other.m_Name)
-  {}
+    m_Storage(Inline)
+  {
+    copyFrom(other);
+  }
+
+  FileNameString(FileNameString &&other) :
+    m_Storage(Inline)
+  {
+    moveFrom(other);
+  }
+
+  ~FileNameString()
+  {
+    release();
+  }
 
   FileNameString &operator=(FileNameString const &other)
   {
-    m_Name = other.m_Name;
+    if (this != &other) {
+      release();
+      copyFrom(other);
+    }
+    return *this;
+  }
+
+  FileNameString &operator=(FileNameString &&other)
+  {
+    if (this != &other) {
+      release();
+      moveFrom(other);
+    }
     return *this;
   }
 
   /** Return the underlying QString. Do not overuse this! */
   QString toQString() const
   {
-    return m_Name;
+    return QString(constData(), size());
+  }
+
+  /** Return the case folded name all comparisons are based on */
+  QString toCaseFolded() const
+  {
+    return QString(foldedData(), size());
+  }
+
+  /** The name as it was given, valid as long as this object isn't modified */
+  QChar const *constData() const
+  {
+    return reinterpret_cast<QChar const *>((m_Storage == Shared) ? m_Shared->text : m_Inline);
+  }
+
+  /** The case folded name, same length as the name. Valid as long as this object isn't modified */
+  QChar const *foldedData() const
+  {
+    switch (m_Storage) {
+      case Inline: return reinterpret_cast<QChar const *>(m_Inline);
+      case InlineFolded: return reinterpret_cast<QChar const *>(m_Inline + m_InlineSize);
+      default: return reinterpret_cast<QChar const *>(m_Shared->separateKey ? m_Shared->text + m_Shared->size
+                                                                             : m_Shared->text);
+    }
+  }
+
+  int size() const
+  {
+    return (m_Storage == Shared) ? m_Shared->size : m_InlineSize;
+  }
+
+  bool isEmpty() const
+  {
+    return size() == 0;
   }
 
   std::wstring toStdWString() const
   {
-    return m_Name.toStdWString();
+    return toQString().toStdWString();
   }
 
   QByteArray toUtf8() const
   {
-    return m_Name.toUtf8();
+    return toQString().toUtf8();
+  }
+
+  QDLLEXPORT bool startsWith(QString const &with) const;
+
+  QDLLEXPORT bool endsWith(QString const &with) const;
+
+ private:
+  //Where name and key live. Most names are short enough to be stored in the
+  //object itself, which saves the allocation and makes copies a plain memcpy
+  enum Storage : unsigned char {
+    //m_Inline holds the name, which is its own key
+    Inline,
+    //m_Inline holds the name followed by the key
+    InlineFolded,
+    //m_Shared is used
+    Shared
+  };
+
+  //Longer names keep name and key in one allocation that copies share, so
+  //there is still only one allocation per distinct name
+  struct Data {
+    std::atomic<int> ref;
+    int size;
+    //The key follows the name if folding changed anything
+    bool separateKey;
+    ushort text[1];
+  };
+
+  //Keeps the object at 40 bytes. With the usual 14 to 16 units per file name
+  //that's less per entry than a QString and its block, a bigger buffer isn't
+  static int const InlineCapacity = 16;
+
+  //The key is computed up front rather than on first use so const names can be
+  //shared between threads without synchronisation
+  QDLLEXPORT void assign(QString const &name);
+
+  QDLLEXPORT void destroy();
+
+  void copyFrom(FileNameString const &other)
+  {
+    if (other.m_Storage == Shared) {
+      m_Shared = other.m_Shared;
+      m_Shared->ref.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      std::memcpy(m_Inline, other.m_Inline, sizeof(m_Inline));
+    }
+    m_Hash = other.m_Hash;
+    m_InlineSize = other.m_InlineSize;
+    m_Storage = other.m_Storage;
   }
 
-  bool startsWith(QString const &with) const
+  void moveFrom(FileNameString &other)
   {
-    return m_Name.startsWith(with, Qt::CaseInsensitive);
+    if (other.m_Storage == Shared) {
+      m_Shared = other.m_Shared;
+    } else {
+      std::memcpy(m_Inline, other.m_Inline, sizeof(m_Inline));
+    }
+    m_Hash = other.m_Hash;
+    m_InlineSize = other.m_InlineSize;
+    m_Storage = other.m_Storage;
+    other.m_Hash = 0;
+    other.m_InlineSize = 0;
+    other.m_Storage = Inline;
   }
 
-  bool endsWith(QString const &with) const
+  void release()
   {
-    return m_Name.endsWith(with, Qt::CaseInsensitive);
+    if (m_Storage == Shared) {
+      if (m_Shared->ref.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        destroy();
+      }
+      m_Storage = Inline;
+    }
   }
 
  private:
-  QString m_Name;
+  uint m_Hash;
+  unsigned char m_InlineSize;
+  Storage m_Storage;
+  union {
+    ushort m_Inline[InlineCapacity];
+    Data *m_Shared;
+  };
+};
+
+/** Case insensitive hash, consistent with the comparison operators */
+QDLLEXPORT uint qHash(FileNameString const &name, uint seed = 0);
+
+}
+
+namespace std {
+
+template <>
+struct hash<MOBase::FileNameString>
+{
+  size_t operator()(MOBase::FileNameString const &name) const
+  {
+    return qHash(name);
+  }
 };
 
 }
@@ -22,501 +22,1298 @@
 
 #include "json.h"
 
-namespace QtJson {
-    static QString sanitizeString(QString str);
-    static QByteArray join(const QList<QByteArray> &list, const QByteArray &sep);
-    static QVariant parseValue(const QString &json, int &index, bool &success);
-    static QVariant parseObject(const QString &json, int &index, bool &success);
-    static QVariant parseArray(const QString &json, int &index, bool &success);
-    static QVariant parseString(const QString &json, int &index, bool &success);
-    static QVariant parseNumber(const QString &json, int &index);
-    static int lastIndexOfNumber(const QString &json, int index);
-    static void eatWhitespace(const QString &json, int &index);
-    static int lookAhead(const QString &json, int index);
-    static int nextToken(const QString &json, int &index);
+#include <QIODevice>
+
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// SSE2 is part of every x64 cpu and is enabled by default for 32 bit builds with
+// current compilers
+#if defined(_M_X64) || defined(__x86_64__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define QTJSON_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
 
+namespace QtJson {
     template<typename T>
-    QByteArray serializeMap(const T &map, bool &success) {
-        QByteArray str = "{ ";
-        QList<QByteArray> pairs;
+    bool writeMap(JsonWriter &writer, const T &map) {
+        writer.startObject();
         for (typename T::const_iterator it = map.begin(), itend = map.end(); it != itend; ++it) {
-            QByteArray serializedValue = serialize(it.value());
-            if (serializedValue.isNull()) {
-                success = false;
-                break;
+            writer.key(it.key());
+            if (!writer.variant(it.value())) {
+                return false;
             }
-            pairs << sanitizeString(it.key()).toUtf8() + " : " + serializedValue;
         }
+        writer.endObject();
+        return true;
+    }
+
+
+    QByteArray serialize(const QVariant &data) {
+        bool success = true;
+        return serialize(data, success);
+    }
+
+    QByteArray serialize(const QVariant &data, bool &success) {
+        JsonWriter writer;
+        success = writer.variant(data);
+        return success ? writer.data() : QByteArray();
+    }
 
-        str += join(pairs, ", ");
-        str += " }";
-        return str;
+    QString serializeStr(const QVariant &data) {
+        return QString::fromUtf8(serialize(data));
+    }
+
+    QString serializeStr(const QVariant &data, bool &success) {
+        return QString::fromUtf8(serialize(data, success));
     }
 
 
     /**
-     * parse
+     * \enum CharacterClass
+     * Flags of characterClasses, the tokenizer looks every character up instead of
+     * comparing it against lists of characters
      */
-    QVariant parse(const QString &json) {
-        bool success = true;
-        return parse(json, success);
+    enum CharacterClass {
+        CharacterWhitespace = 1,
+        CharacterNumber = 2,
+        CharacterStringEnd = 4
+    };
+
+    struct CharacterClasses {
+        unsigned char flags[256];
+
+        CharacterClasses() {
+            std::memset(flags, 0, sizeof(flags));
+            for (const char *c = " \t\n\r"; *c != '\0'; ++c) {
+                flags[static_cast<unsigned char>(*c)] |= CharacterWhitespace;
+            }
+            for (const char *c = "0123456789+-.eE"; *c != '\0'; ++c) {
+                flags[static_cast<unsigned char>(*c)] |= CharacterNumber;
+            }
+            flags[static_cast<unsigned char>('"')] |= CharacterStringEnd;
+            flags[static_cast<unsigned char>('\\')] |= CharacterStringEnd;
+        }
+
+        bool is(char c, CharacterClass characterClass) const {
+            return (flags[static_cast<unsigned char>(c)] & characterClass) != 0;
+        }
+    };
+
+    static const CharacterClasses characterClasses;
+
+#ifdef QTJSON_SSE2
+    static int lowestBit(int mask) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, static_cast<unsigned long>(mask));
+        return static_cast<int>(index);
+#else
+        return __builtin_ctz(static_cast<unsigned int>(mask));
+#endif
     }
+#endif
 
     /**
-     * parse
+     * findStringEnd
+     * \return the first quote or backslash in [pos, end) or end. 16 characters are
+     *         checked at a time, so long strings without escapes are found in a few steps
      */
-    QVariant parse(const QString &json, bool &success) {
-        success = true;
+    static const char *findStringEnd(const char *pos, const char *end) {
+#ifdef QTJSON_SSE2
+        const __m128i quote = _mm_set1_epi8('"');
+        const __m128i backslash = _mm_set1_epi8('\\');
+        for (; end - pos >= 16; pos += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+            int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, quote),
+                                                      _mm_cmpeq_epi8(block, backslash)));
+            if (mask != 0) {
+                return pos + lowestBit(mask);
+            }
+        }
+#endif
+        while ((pos != end) && !characterClasses.is(*pos, CharacterStringEnd)) {
+            ++pos;
+        }
+        return pos;
+    }
 
-        // Return an empty QVariant if the JSON data is either null or empty
-        if (!json.isNull() || !json.isEmpty()) {
-            QString data = json;
-            // We'll start from index 0
-            int index = 0;
+    /**
+     * skipWhitespace
+     * \return the first character in [pos, end) that isn't whitespace or end
+     */
+    static const char *skipWhitespace(const char *pos, const char *end) {
+        // between tokens there is usually no whitespace or a single space. Only the
+        // indentation of pretty printed documents is worth scanning in blocks
+        for (int i = 0; i < 2; ++i) {
+            if ((pos == end) || !characterClasses.is(*pos, CharacterWhitespace)) {
+                return pos;
+            }
+            ++pos;
+        }
+#ifdef QTJSON_SSE2
+        for (; end - pos >= 16; pos += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+            __m128i whitespace = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\t'))),
+                _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\r'))));
+            int mask = _mm_movemask_epi8(whitespace) ^ 0xFFFF;
+            if (mask != 0) {
+                return pos + lowestBit(mask);
+            }
+        }
+#endif
+        while ((pos != end) && characterClasses.is(*pos, CharacterWhitespace)) {
+            ++pos;
+        }
+        return pos;
+    }
 
-            // Parse the first value
-            QVariant value = parseValue(data, index, success);
 
-            // Return the parsed value
-            return value;
-        } else {
-            // Return the empty QVariant
-            return QVariant();
+    /**
+     * \class EventParser
+     * \brief Walks UTF-8 JSON data once and reports what it finds to a JsonHandler
+     *
+     * Nested values are tracked on an explicit stack instead of by recursion, so deeply
+     * nested documents can't exhaust the call stack.
+     * A lenient parser accepts what parse(QString) always did: missing and repeated commas
+     * and unknown escape sequences, which are dropped.
+     */
+    class EventParser {
+    public:
+        EventParser(const char *begin, const char *end, JsonHandler &handler, bool lenient = false)
+            : m_Pos(begin), m_End(end), m_Handler(handler), m_Lenient(lenient) {
+        }
+
+        bool run();
+
+    private:
+        void eatWhitespace();
+        void eatCommas();
+        bool parseScalar();
+        bool parseKey();
+        bool parseString(bool isKey);
+        bool parseEscape();
+        bool parseHex(uint &value);
+        void appendUtf8(uint codePoint);
+        bool parseNumber();
+        bool parseLiteral(const char *literal, int length);
+
+    private:
+        const char *m_Pos;
+        const char *m_End;
+        JsonHandler &m_Handler;
+        bool m_Lenient;
+        // holds strings that contain escape sequences, reused for all of them
+        QByteArray m_Buffer;
+    };
+
+    bool EventParser::run() {
+        // '{' or '[' for every container that is currently open
+        std::vector<char> containers;
+
+        for (;;) {
+            // a value is expected
+            eatWhitespace();
+            if (m_Pos == m_End) {
+                return false;
+            }
+
+            bool done = false;
+            if (*m_Pos == '{') {
+                ++m_Pos;
+                if (!m_Handler.startObject()) {
+                    return false;
+                }
+                eatCommas();
+                if ((m_Pos != m_End) && (*m_Pos == '}')) {
+                    ++m_Pos;
+                    if (!m_Handler.endObject()) {
+                        return false;
+                    }
+                    done = true;
+                } else {
+                    containers.push_back('{');
+                    if (!parseKey()) {
+                        return false;
+                    }
+                }
+            } else if (*m_Pos == '[') {
+                ++m_Pos;
+                if (!m_Handler.startArray()) {
+                    return false;
+                }
+                eatCommas();
+                if ((m_Pos != m_End) && (*m_Pos == ']')) {
+                    ++m_Pos;
+                    if (!m_Handler.endArray()) {
+                        return false;
+                    }
+                    done = true;
+                } else {
+                    containers.push_back('[');
+                }
+            } else {
+                if (!parseScalar()) {
+                    return false;
+                }
+                done = true;
+            }
+
+            // a value is complete, close containers until one continues with another value
+            while (done) {
+                if (containers.empty()) {
+                    // anything after the first value is ignored
+                    return true;
+                }
+                eatWhitespace();
+                if (m_Pos == m_End) {
+                    return false;
+                }
+                if (m_Lenient) {
+                    // any number of commas, including none, before the next value or the end
+                    eatCommas();
+                    if (m_Pos == m_End) {
+                        return false;
+                    }
+                    if (*m_Pos != ((containers.back() == '{') ? '}' : ']')) {
+                        if ((containers.back() == '{') && !parseKey()) {
+                            return false;
+                        }
+                        done = false;
+                        continue;
+                    }
+                }
+                char c = *m_Pos++;
+                if (c == ',') {
+                    if ((containers.back() == '{') && !parseKey()) {
+                        return false;
+                    }
+                    done = false;
+                } else if ((c == '}') && (containers.back() == '{')) {
+                    containers.pop_back();
+                    if (!m_Handler.endObject()) {
+                        return false;
+                    }
+                } else if ((c == ']') && (containers.back() == '[')) {
+                    containers.pop_back();
+                    if (!m_Handler.endArray()) {
+                        return false;
+                    }
+                } else {
+                    return false;
+                }
+            }
         }
     }
 
-    QByteArray serialize(const QVariant &data) {
-        bool success = true;
-        return serialize(data, success);
+    void EventParser::eatWhitespace() {
+        m_Pos = skipWhitespace(m_Pos, m_End);
     }
 
-    QByteArray serialize(const QVariant &data, bool &success) {
-        QByteArray str;
-        success = true;
+    void EventParser::eatCommas() {
+        eatWhitespace();
+        while (m_Lenient && (m_Pos != m_End) && (*m_Pos == ',')) {
+            ++m_Pos;
+            eatWhitespace();
+        }
+    }
 
-        if (!data.isValid()) { // invalid or null?
-            str = "null";
-        } else if ((data.type() == QVariant::List) ||
-                   (data.type() == QVariant::StringList)) { // variant is a list?
-            QList<QByteArray> values;
-            const QVariantList list = data.toList();
-            Q_FOREACH(const QVariant& v, list) {
-                QByteArray serializedValue = serialize(v);
-                if (serializedValue.isNull()) {
-                    success = false;
+    bool EventParser::parseScalar() {
+        switch (*m_Pos) {
+            case '"':
+                return parseString(false);
+            case 't':
+                return parseLiteral("true", 4) && m_Handler.boolean(true);
+            case 'f':
+                return parseLiteral("false", 5) && m_Handler.boolean(false);
+            case 'n':
+                return parseLiteral("null", 4) && m_Handler.null();
+            default:
+                return parseNumber();
+        }
+    }
+
+    bool EventParser::parseKey() {
+        eatWhitespace();
+        if ((m_Pos == m_End) || (*m_Pos != '"') || !parseString(true)) {
+            return false;
+        }
+        eatWhitespace();
+        if ((m_Pos == m_End) || (*m_Pos != ':')) {
+            return false;
+        }
+        ++m_Pos;
+        return true;
+    }
+
+    bool EventParser::parseString(bool isKey) {
+        // skip the opening quote
+        const char *start = ++m_Pos;
+        m_Pos = findStringEnd(m_Pos, m_End);
+        if (m_Pos == m_End) {
+            return false;
+        }
+
+        const char *data = start;
+        int size = static_cast<int>(m_Pos - start);
+        if (*m_Pos == '\\') {
+            // only strings with escape sequences have to be copied. The text between
+            // escape sequences is copied in one piece
+            m_Buffer.clear();
+            for (;;) {
+                m_Buffer.append(start, static_cast<int>(m_Pos - start));
+                if (*m_Pos == '"') {
                     break;
                 }
-                values << serializedValue;
+                ++m_Pos;
+                if (!parseEscape()) {
+                    return false;
+                }
+                start = m_Pos;
+                m_Pos = findStringEnd(m_Pos, m_End);
+                if (m_Pos == m_End) {
+                    return false;
+                }
             }
+            data = m_Buffer.constData();
+            size = m_Buffer.size();
+        }
+        // skip the closing quote
+        ++m_Pos;
 
-            str = "[ " + join( values, ", " ) + " ]";
-        } else if (data.type() == QVariant::Hash) { // variant is a hash?
-            str = serializeMap<>(data.toHash(), success);
-        } else if (data.type() == QVariant::Map) { // variant is a map?
-            str = serializeMap<>(data.toMap(), success);
-        } else if ((data.type() == QVariant::String) ||
-                   (data.type() == QVariant::ByteArray)) {// a string or a byte array?
-            str = sanitizeString(data.toString()).toUtf8();
-        } else if (data.type() == QVariant::Double) { // double?
-            double value = data.toDouble();
-            if ((value - value) == 0.0) {
-                str = QByteArray::number(value, 'g');
-                if (!str.contains(".") && ! str.contains("e")) {
-                    str += ".0";
+        return isKey ? m_Handler.key(data, size) : m_Handler.string(data, size);
+    }
+
+    bool EventParser::parseEscape() {
+        if (m_Pos == m_End) {
+            return false;
+        }
+        switch (*m_Pos++) {
+            case '"': m_Buffer.append('"'); return true;
+            case '\\': m_Buffer.append('\\'); return true;
+            case '/': m_Buffer.append('/'); return true;
+            case 'b': m_Buffer.append('\b'); return true;
+            case 'f': m_Buffer.append('\f'); return true;
+            case 'n': m_Buffer.append('\n'); return true;
+            case 'r': m_Buffer.append('\r'); return true;
+            case 't': m_Buffer.append('\t'); return true;
+            case 'u': {
+                uint codePoint;
+                if (!parseHex(codePoint)) {
+                    return false;
+                }
+                // characters outside the BMP are escaped as a surrogate pair
+                if (QChar::isHighSurrogate(codePoint) && (m_End - m_Pos >= 6)
+                    && (m_Pos[0] == '\\') && (m_Pos[1] == 'u')) {
+                    const char *saved = m_Pos;
+                    m_Pos += 2;
+                    uint low;
+                    if (parseHex(low) && QChar::isLowSurrogate(low)) {
+                        codePoint = QChar::surrogateToUcs4(codePoint, low);
+                    } else {
+                        m_Pos = saved;
+                    }
+                }
+                // a surrogate that isn't part of a pair can't be encoded as UTF-8
+                if ((codePoint >= 0xD800) && (codePoint <= 0xDFFF)) {
+                    codePoint = 0xFFFD;
                 }
+                appendUtf8(codePoint);
+                return true;
+            }
+            default:
+                return m_Lenient;
+        }
+    }
+
+    bool EventParser::parseHex(uint &value) {
+        if (m_End - m_Pos < 4) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = *m_Pos++;
+            value <<= 4;
+            if ((c >= '0') && (c <= '9')) {
+                value |= c - '0';
+            } else if ((c >= 'a') && (c <= 'f')) {
+                value |= c - 'a' + 10;
+            } else if ((c >= 'A') && (c <= 'F')) {
+                value |= c - 'A' + 10;
             } else {
-                success = false;
+                return false;
             }
-        } else if (data.type() == QVariant::Bool) { // boolean value?
-            str = data.toBool() ? "true" : "false";
-        } else if (data.type() == QVariant::ULongLong) { // large unsigned number?
-            str = QByteArray::number(data.value<qulonglong>());
-        } else if (data.canConvert<qlonglong>()) { // any signed number?
-            str = QByteArray::number(data.value<qlonglong>());
-        } else if (data.canConvert<long>()) { //TODO: this code is never executed
-            str = QString::number(data.value<long>()).toUtf8();
-        } else if (data.canConvert<QString>()) { // can value be converted to string?
-            // this will catch QDate, QDateTime, QUrl, ...
-            str = sanitizeString(data.toString()).toUtf8();
-        } else {
-            success = false;
         }
+        return true;
+    }
 
-        if (success) {
-            return str;
+    void EventParser::appendUtf8(uint codePoint) {
+        if (codePoint < 0x80) {
+            m_Buffer.append(static_cast<char>(codePoint));
+        } else if (codePoint < 0x800) {
+            m_Buffer.append(static_cast<char>(0xC0 | (codePoint >> 6)));
+            m_Buffer.append(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        } else if (codePoint < 0x10000) {
+            m_Buffer.append(static_cast<char>(0xE0 | (codePoint >> 12)));
+            m_Buffer.append(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            m_Buffer.append(static_cast<char>(0x80 | (codePoint & 0x3F)));
         } else {
-            return QByteArray();
+            m_Buffer.append(static_cast<char>(0xF0 | (codePoint >> 18)));
+            m_Buffer.append(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+            m_Buffer.append(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+            m_Buffer.append(static_cast<char>(0x80 | (codePoint & 0x3F)));
         }
     }
 
-    QString serializeStr(const QVariant &data) {
-        return QString::fromUtf8(serialize(data));
+    bool EventParser::parseNumber() {
+        const char *start = m_Pos;
+        bool digits = false;
+        while ((m_Pos != m_End) && characterClasses.is(*m_Pos, CharacterNumber)) {
+            digits = digits || ((*m_Pos >= '0') && (*m_Pos <= '9'));
+            ++m_Pos;
+        }
+        return digits && m_Handler.number(start, static_cast<int>(m_Pos - start));
     }
 
-    QString serializeStr(const QVariant &data, bool &success) {
-        return QString::fromUtf8(serialize(data, success));
+    bool EventParser::parseLiteral(const char *literal, int length) {
+        if ((m_End - m_Pos < length) || (std::memcmp(m_Pos, literal, length) != 0)) {
+            return false;
+        }
+        m_Pos += length;
+        return true;
     }
 
 
-    /**
-     * \enum JsonToken
-     */
-    enum JsonToken {
-        JsonTokenNone = 0,
-        JsonTokenCurlyOpen = 1,
-        JsonTokenCurlyClose = 2,
-        JsonTokenSquaredOpen = 3,
-        JsonTokenSquaredClose = 4,
-        JsonTokenColon = 5,
-        JsonTokenComma = 6,
-        JsonTokenString = 7,
-        JsonTokenNumber = 8,
-        JsonTokenTrue = 9,
-        JsonTokenFalse = 10,
-        JsonTokenNull = 11
-    };
+    bool VariantBuilder::startObject() {
+        m_Stack.push_back(Container());
+        m_Stack.back().isObject = true;
+        return true;
+    }
 
-    static QString sanitizeString(QString str) {
-        str.replace(QLatin1String("\\"), QLatin1String("\\\\"));
-        str.replace(QLatin1String("\""), QLatin1String("\\\""));
-        str.replace(QLatin1String("\b"), QLatin1String("\\b"));
-        str.replace(QLatin1String("\f"), QLatin1String("\\f"));
-        str.replace(QLatin1String("\n"), QLatin1String("\\n"));
-        str.replace(QLatin1String("\r"), QLatin1String("\\r"));
-        str.replace(QLatin1String("\t"), QLatin1String("\\t"));
-        return QString(QLatin1String("\"%1\"")).arg(str);
-    }
-
-    static QByteArray join(const QList<QByteArray> &list, const QByteArray &sep) {
-        QByteArray res;
-        Q_FOREACH(const QByteArray &i, list) {
-            if (!res.isEmpty()) {
-                res += sep;
-            }
-            res += i;
-        }
-        return res;
+    bool VariantBuilder::endObject() {
+        QVariant value(m_Stack.back().map);
+        m_Stack.pop_back();
+        add(value);
+        return true;
     }
 
-    /**
-     * parseValue
-     */
-    static QVariant parseValue(const QString &json, int &index, bool &success) {
-        // Determine what kind of data we should parse by
-        // checking out the upcoming token
-        switch(lookAhead(json, index)) {
-            case JsonTokenString:
-                return parseString(json, index, success);
-            case JsonTokenNumber:
-                return parseNumber(json, index);
-            case JsonTokenCurlyOpen:
-                return parseObject(json, index, success);
-            case JsonTokenSquaredOpen:
-                return parseArray(json, index, success);
-            case JsonTokenTrue:
-                nextToken(json, index);
-                return QVariant(true);
-            case JsonTokenFalse:
-                nextToken(json, index);
-                return QVariant(false);
-            case JsonTokenNull:
-                nextToken(json, index);
-                return QVariant();
-            case JsonTokenNone:
-                break;
-        }
-
-        // If there were no tokens, flag the failure and return an empty QVariant
-        success = false;
-        return QVariant();
+    bool VariantBuilder::startArray() {
+        m_Stack.push_back(Container());
+        m_Stack.back().isObject = false;
+        return true;
     }
 
-    /**
-     * parseObject
-     */
-    static QVariant parseObject(const QString &json, int &index, bool &success) {
-        QVariantMap map;
-        int token;
-
-        // Get rid of the whitespace and increment index
-        nextToken(json, index);
-
-        // Loop through all of the key/value pairs of the object
-        bool done = false;
-        while (!done) {
-            // Get the upcoming token
-            token = lookAhead(json, index);
-
-            if (token == JsonTokenNone) {
-                success = false;
-                return QVariantMap();
-            } else if (token == JsonTokenComma) {
-                nextToken(json, index);
-            } else if (token == JsonTokenCurlyClose) {
-                nextToken(json, index);
-                return map;
-            } else {
-                // Parse the key/value pair's name
-                QString name = parseString(json, index, success).toString();
+    bool VariantBuilder::endArray() {
+        QVariant value(m_Stack.back().list);
+        m_Stack.pop_back();
+        add(value);
+        return true;
+    }
 
-                if (!success) {
-                    return QVariantMap();
-                }
+    bool VariantBuilder::key(const char *data, int size) {
+        m_Stack.back().key = QString::fromUtf8(data, size);
+        return true;
+    }
 
-                // Get the next token
-                token = nextToken(json, index);
+    bool VariantBuilder::string(const char *data, int size) {
+        add(QString::fromUtf8(data, size));
+        return true;
+    }
 
-                // If the next token is not a colon, flag the failure
-                // return an empty QVariant
-                if (token != JsonTokenColon) {
-                    success = false;
-                    return QVariant(QVariantMap());
-                }
+    bool VariantBuilder::number(const char *data, int size) {
+        add(numberValue(QByteArray::fromRawData(data, size)));
+        return true;
+    }
 
-                // Parse the key/value pair's value
-                QVariant value = parseValue(json, index, success);
+    bool VariantBuilder::boolean(bool value) {
+        add(QVariant(value));
+        return true;
+    }
 
-                if (!success) {
-                    return QVariantMap();
-                }
+    bool VariantBuilder::null() {
+        add(QVariant());
+        return true;
+    }
 
-                // Assign the value to the key in the map
-                map[name] = value;
-            }
+    void VariantBuilder::add(const QVariant &value) {
+        if (m_Stack.empty()) {
+            m_Result = value;
+        } else if (m_Stack.back().isObject) {
+            m_Stack.back().map[m_Stack.back().key] = value;
+        } else {
+            m_Stack.back().list.push_back(value);
         }
+    }
 
-        // Return the map successfully
-        return QVariant(map);
+    // the smallest type that holds the number
+    QVariant VariantBuilder::numberValue(const QByteArray &number) const {
+        bool ok;
+        bool exponent = number.contains('e') || number.contains('E');
+        if (number.contains('.') || (exponent && !(m_Options & LegacyNumbers))) {
+            return QVariant(number.toDouble());
+        } else if (number.startsWith('-')) {
+            int i = number.toInt(&ok);
+            if (!ok) {
+                qlonglong ll = number.toLongLong(&ok);
+                return ok ? QVariant(ll) : QVariant(QString::fromUtf8(number));
+            }
+            return QVariant(i);
+        } else {
+            uint u = number.toUInt(&ok);
+            if (!ok) {
+                qulonglong ull = number.toULongLong(&ok);
+                return ok ? QVariant(ull) : QVariant(QString::fromUtf8(number));
+            }
+            return QVariant(u);
+        }
     }
 
+
     /**
-     * parseArray
+     * \class DocumentBuilder
+     * \brief Fills a JsonDocument from the events of parseEvents
+     *
+     * The elements of a container are collected on a stack while it is parsed and
+     * copied to the document in one piece once it ends, so they are contiguous.
      */
-    static QVariant parseArray(const QString &json, int &index, bool &success) {
-        QVariantList list;
-
-        nextToken(json, index);
-
-        bool done = false;
-        while(!done) {
-            int token = lookAhead(json, index);
-
-            if (token == JsonTokenNone) {
-                success = false;
-                return QVariantList();
-            } else if (token == JsonTokenComma) {
-                nextToken(json, index);
-            } else if (token == JsonTokenSquaredClose) {
-                nextToken(json, index);
-                break;
+    class DocumentBuilder : public JsonHandler {
+    public:
+        DocumentBuilder(JsonDocument &document, int options)
+            : m_Document(document)
+            , m_Begin(document.m_Source.constData())
+            , m_End(document.m_Source.constData() + document.m_Source.size())
+            , m_Options(options) {
+        }
+
+        virtual bool startObject() {
+            startContainer(JsonValue::Object);
+            return true;
+        }
+
+        virtual bool endObject() {
+            JsonDocument::Value &object = endContainer();
+            object.size /= 2;
+            if (((m_Options & JsonDocument::HashObjects) != 0) &&
+                (object.size >= static_cast<quint32>(JsonDocument::HashThreshold))) {
+                m_Document.buildTable(object);
+            }
+            return true;
+        }
+
+        virtual bool startArray() {
+            startContainer(JsonValue::Array);
+            return true;
+        }
+
+        virtual bool endArray() {
+            endContainer();
+            return true;
+        }
+
+        virtual bool key(const char *data, int size) {
+            // keys are stored as string values, objects hold key/value pairs
+            addText(JsonValue::String, data, size);
+            return true;
+        }
+
+        virtual bool string(const char *data, int size) {
+            addText(JsonValue::String, data, size);
+            return true;
+        }
+
+        virtual bool number(const char *data, int size) {
+            addText(JsonValue::Number, data, size);
+            return true;
+        }
+
+        virtual bool boolean(bool value) {
+            addValue(JsonValue::Bool, 0, 0, value);
+            return true;
+        }
+
+        virtual bool null() {
+            addValue(JsonValue::Null, 0, 0, false);
+            return true;
+        }
+
+    private:
+        quint32 addValue(JsonValue::Type type, quint32 offset, quint32 size, bool flag) {
+            JsonDocument::Value value = { offset, size, JsonDocument::NoTable, static_cast<quint8>(type), flag };
+            quint32 index = static_cast<quint32>(m_Document.m_Values.size());
+            m_Document.m_Values.push_back(value);
+            if (!m_Containers.empty()) {
+                m_Elements.push_back(index);
+            }
+            return index;
+        }
+
+        void addText(JsonValue::Type type, const char *data, int size) {
+            if ((data >= m_Begin) && (data + size <= m_End)) {
+                // unescaped text is passed straight from the source
+                addValue(type, static_cast<quint32>(data - m_Begin), size, false);
             } else {
-                QVariant value = parseValue(json, index, success);
-                if (!success) {
-                    return QVariantList();
-                }
-                list.push_back(value);
+                addValue(type, static_cast<quint32>(m_Document.m_Strings.size()), size, true);
+                m_Document.m_Strings.append(data, size);
             }
         }
 
-        return QVariant(list);
+        void startContainer(JsonValue::Type type) {
+            Container container = { addValue(type, 0, 0, false), m_Elements.size() };
+            m_Containers.push_back(container);
+        }
+
+        JsonDocument::Value &endContainer() {
+            Container container = m_Containers.back();
+            m_Containers.pop_back();
+            std::vector<quint32> &links = m_Document.m_Links;
+            JsonDocument::Value &value = m_Document.m_Values[container.value];
+            value.offset = static_cast<quint32>(links.size());
+            value.size = static_cast<quint32>(m_Elements.size() - container.firstElement);
+            links.insert(links.end(), m_Elements.begin() + container.firstElement, m_Elements.end());
+            m_Elements.resize(container.firstElement);
+            return value;
+        }
+
+    private:
+        struct Container {
+            quint32 value;
+            size_t firstElement;
+        };
+
+        JsonDocument &m_Document;
+        const char *m_Begin;
+        const char *m_End;
+        int m_Options;
+        std::vector<Container> m_Containers;
+        std::vector<quint32> m_Elements;
+    };
+
+
+    JsonDocument::JsonDocument() {
     }
 
-    /**
-     * parseString
-     */
-    static QVariant parseString(const QString &json, int &index, bool &success) {
-        QString s;
-        QChar c;
+    bool JsonDocument::parse(const QByteArray &json, int options) {
+        m_Source = json;
+        m_Strings.clear();
+        m_Values.clear();
+        m_Links.clear();
+        // a guess that avoids most reallocations for typical documents
+        m_Values.reserve(json.size() / 16 + 1);
+
+        DocumentBuilder builder(*this, options);
+        if (!parseEvents(m_Source, builder)) {
+            m_Source.clear();
+            m_Strings.clear();
+            m_Values.clear();
+            m_Links.clear();
+            return false;
+        }
+        return true;
+    }
 
-        eatWhitespace(json, index);
+    JsonValue JsonDocument::root() const {
+        return m_Values.empty() ? JsonValue() : JsonValue(this, 0);
+    }
 
-        c = json[index++];
+    const char *JsonDocument::text(const Value &value) const {
+        return (value.flag ? m_Strings.constData() : m_Source.constData()) + value.offset;
+    }
 
-        bool complete = false;
-        while(!complete) {
-            if (index == json.size()) {
-                break;
-            }
+    quint32 JsonDocument::hashKey(const char *key, int size) {
+        // FNV-1a
+        quint32 hash = 2166136261u;
+        for (int i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<unsigned char>(key[i])) * 16777619u;
+        }
+        return hash;
+    }
 
-            c = json[index++];
+    quint32 JsonDocument::tableCapacity(quint32 size) {
+        // a power of two, at most half full
+        quint32 capacity = 16;
+        while (capacity < size * 2) {
+            capacity *= 2;
+        }
+        return capacity;
+    }
 
-            if (c == '\"') {
-                complete = true;
-                break;
-            } else if (c == '\\') {
-                if (index == json.size()) {
+    void JsonDocument::buildTable(Value &object) {
+        quint32 capacity = tableCapacity(object.size);
+        object.table = static_cast<quint32>(m_Links.size());
+        // slots hold the member index + 1, 0 is empty
+        m_Links.resize(m_Links.size() + capacity, 0);
+        quint32 *slots = &m_Links[object.table];
+        for (quint32 member = 0; member < object.size; ++member) {
+            const Value &key = m_Values[m_Links[object.offset + member * 2]];
+            quint32 slot = hashKey(text(key), key.size) & (capacity - 1);
+            bool duplicate = false;
+            while (slots[slot] != 0) {
+                const Value &other = m_Values[m_Links[object.offset + (slots[slot] - 1) * 2]];
+                if ((other.size == key.size) && (std::memcmp(text(other), text(key), key.size) == 0)) {
+                    // keep the first member, as the linear search would
+                    duplicate = true;
                     break;
                 }
+                slot = (slot + 1) & (capacity - 1);
+            }
+            if (!duplicate) {
+                slots[slot] = member + 1;
+            }
+        }
+    }
 
-                c = json[index++];
-
-                if (c == '\"') {
-                    s.append('\"');
-                } else if (c == '\\') {
-                    s.append('\\');
-                } else if (c == '/') {
-                    s.append('/');
-                } else if (c == 'b') {
-                    s.append('\b');
-                } else if (c == 'f') {
-                    s.append('\f');
-                } else if (c == 'n') {
-                    s.append('\n');
-                } else if (c == 'r') {
-                    s.append('\r');
-                } else if (c == 't') {
-                    s.append('\t');
-                } else if (c == 'u') {
-                    int remainingLength = json.size() - index;
-                    if (remainingLength >= 4) {
-                        QString unicodeStr = json.mid(index, 4);
-
-                        int symbol = unicodeStr.toInt(0, 16);
-
-                        s.append(QChar(symbol));
-
-                        index += 4;
-                    } else {
-                        break;
-                    }
+    quint32 JsonDocument::lookup(const Value &object, const char *key, int size) const {
+        if (object.table != NoTable) {
+            quint32 capacity = tableCapacity(object.size);
+            const quint32 *slots = &m_Links[object.table];
+            for (quint32 slot = hashKey(key, size) & (capacity - 1); slots[slot] != 0;
+                 slot = (slot + 1) & (capacity - 1)) {
+                quint32 pair = object.offset + (slots[slot] - 1) * 2;
+                const Value &name = m_Values[m_Links[pair]];
+                if ((name.size == static_cast<quint32>(size)) && (std::memcmp(text(name), key, size) == 0)) {
+                    return m_Links[pair + 1];
+                }
+            }
+        } else {
+            for (quint32 pair = object.offset; pair < object.offset + object.size * 2; pair += 2) {
+                const Value &name = m_Values[m_Links[pair]];
+                if ((name.size == static_cast<quint32>(size)) && (std::memcmp(text(name), key, size) == 0)) {
+                    return m_Links[pair + 1];
                 }
-            } else {
-                s.append(c);
             }
         }
+        return NoTable;
+    }
 
-        if (!complete) {
-            success = false;
-            return QVariant();
-        }
 
-        return QVariant(s);
+    JsonValue::JsonValue()
+        : m_Document(nullptr), m_Index(0) {
     }
 
-    /**
-     * parseNumber
-     */
-    static QVariant parseNumber(const QString &json, int &index) {
-        eatWhitespace(json, index);
+    JsonValue::JsonValue(const JsonDocument *document, quint32 index)
+        : m_Document(document), m_Index(index) {
+    }
+
+    JsonValue::Type JsonValue::type() const {
+        return m_Document != nullptr ? static_cast<Type>(m_Document->m_Values[m_Index].type) : Undefined;
+    }
+
+    bool JsonValue::toBool(bool defaultValue) const {
+        return isBool() ? m_Document->m_Values[m_Index].flag : defaultValue;
+    }
 
-        int lastIndex = lastIndexOfNumber(json, index);
-        int charLength = (lastIndex - index) + 1;
-        QString numberStr;
+    int JsonValue::toInt(int defaultValue) const {
+        qlonglong value = toLongLong(defaultValue);
+        return ((value >= INT_MIN) && (value <= INT_MAX)) ? static_cast<int>(value) : defaultValue;
+    }
 
-        numberStr = json.mid(index, charLength);
+    qlonglong JsonValue::toLongLong(qlonglong defaultValue) const {
+        if (!isNumber()) {
+            return defaultValue;
+        }
+        bool ok;
+        QByteArray number = QByteArray::fromRawData(textData(), textSize());
+        qlonglong value = number.toLongLong(&ok);
+        if (!ok) {
+            // a fraction or exponent
+            double fraction = number.toDouble(&ok);
+            return ok ? static_cast<qlonglong>(fraction) : defaultValue;
+        }
+        return value;
+    }
 
-        index = lastIndex + 1;
+    double JsonValue::toDouble(double defaultValue) const {
+        if (!isNumber()) {
+            return defaultValue;
+        }
         bool ok;
+        double value = QByteArray::fromRawData(textData(), textSize()).toDouble(&ok);
+        return ok ? value : defaultValue;
+    }
 
-        if (numberStr.contains('.')) {
-            return QVariant(numberStr.toDouble(nullptr));
-        } else if (numberStr.startsWith('-')) {
-            int i = numberStr.toInt(&ok);
-            if (!ok) {
-                qlonglong ll = numberStr.toLongLong(&ok);
-                return ok ? ll : QVariant(numberStr);
-            }
-            return i;
+    QString JsonValue::toString(const QString &defaultValue) const {
+        return isString() ? QString::fromUtf8(textData(), textSize()) : defaultValue;
+    }
+
+    const char *JsonValue::textData() const {
+        Type valueType = type();
+        if ((valueType != String) && (valueType != Number)) {
+            return nullptr;
+        }
+        return m_Document->text(m_Document->m_Values[m_Index]);
+    }
+
+    int JsonValue::textSize() const {
+        Type valueType = type();
+        if ((valueType != String) && (valueType != Number)) {
+            return 0;
+        }
+        return static_cast<int>(m_Document->m_Values[m_Index].size);
+    }
+
+    int JsonValue::size() const {
+        Type valueType = type();
+        if ((valueType != Array) && (valueType != Object)) {
+            return 0;
+        }
+        return static_cast<int>(m_Document->m_Values[m_Index].size);
+    }
+
+    JsonValue JsonValue::at(int index) const {
+        if ((index < 0) || (index >= size())) {
+            return JsonValue();
+        }
+        const JsonDocument::Value &container = m_Document->m_Values[m_Index];
+        if (container.type == Object) {
+            return JsonValue(m_Document, m_Document->m_Links[container.offset + index * 2 + 1]);
         } else {
-            uint u = numberStr.toUInt(&ok);
+            return JsonValue(m_Document, m_Document->m_Links[container.offset + index]);
+        }
+    }
+
+    QString JsonValue::keyAt(int index) const {
+        if (!isObject() || (index < 0) || (index >= size())) {
+            return QString();
+        }
+        const JsonDocument::Value &object = m_Document->m_Values[m_Index];
+        return JsonValue(m_Document, m_Document->m_Links[object.offset + index * 2]).toString();
+    }
+
+    JsonValue JsonValue::value(const char *key, int size) const {
+        if (!isObject()) {
+            return JsonValue();
+        }
+        quint32 index = m_Document->lookup(m_Document->m_Values[m_Index], key, size);
+        return index != JsonDocument::NoTable ? JsonValue(m_Document, index) : JsonValue();
+    }
+
+    JsonValue JsonValue::value(const char *key) const {
+        return value(key, static_cast<int>(std::strlen(key)));
+    }
+
+    JsonValue JsonValue::value(const QString &key) const {
+        QByteArray utf8 = key.toUtf8();
+        return value(utf8.constData(), utf8.size());
+    }
+
+    QVariant JsonValue::toVariant() const {
+        VariantBuilder builder;
+        write(builder);
+        return builder.result();
+    }
+
+    bool JsonValue::write(JsonHandler &handler) const {
+        if (isUndefined()) {
+            return false;
+        }
+
+        const std::vector<JsonDocument::Value> &values = m_Document->m_Values;
+        const std::vector<quint32> &links = m_Document->m_Links;
+
+        // iterative so deeply nested documents can't overflow the stack
+        struct Container {
+            quint32 value;
+            quint32 next;
+        };
+        std::vector<Container> stack;
+
+        quint32 current = m_Index;
+        for (;;) {
+            const JsonDocument::Value &value = values[current];
+            bool ok = true;
+            switch (value.type) {
+                case Null: ok = handler.null(); break;
+                case Bool: ok = handler.boolean(value.flag); break;
+                case Number: ok = handler.number(m_Document->text(value), value.size); break;
+                case String: ok = handler.string(m_Document->text(value), value.size); break;
+                case Array: {
+                    ok = handler.startArray();
+                    Container container = { current, 0 };
+                    stack.push_back(container);
+                } break;
+                case Object: {
+                    ok = handler.startObject();
+                    Container container = { current, 0 };
+                    stack.push_back(container);
+                } break;
+            }
             if (!ok) {
-                qulonglong ull = numberStr.toULongLong(&ok);
-                return ok ? ull : QVariant(numberStr);
+                return false;
+            }
+
+            // find the next value, closing the containers that are done
+            current = JsonDocument::NoTable;
+            while (!stack.empty() && (current == JsonDocument::NoTable)) {
+                Container &container = stack.back();
+                const JsonDocument::Value &parent = values[container.value];
+                if (container.next < parent.size) {
+                    if (parent.type == Object) {
+                        const JsonDocument::Value &name = values[links[parent.offset + container.next * 2]];
+                        if (!handler.key(m_Document->text(name), name.size)) {
+                            return false;
+                        }
+                        current = links[parent.offset + container.next * 2 + 1];
+                    } else {
+                        current = links[parent.offset + container.next];
+                    }
+                    ++container.next;
+                } else {
+                    ok = parent.type == Object ? handler.endObject() : handler.endArray();
+                    stack.pop_back();
+                    if (!ok) {
+                        return false;
+                    }
+                }
+            }
+            if (current == JsonDocument::NoTable) {
+                return true;
             }
-            return u;
         }
     }
 
+
     /**
-     * lastIndexOfNumber
+     * parseEvents
      */
-    static int lastIndexOfNumber(const QString &json, int index) {
-        int lastIndex;
+    bool parseEvents(const char *begin, const char *end, JsonHandler &handler) {
+        EventParser parser(begin, end, handler);
+        return parser.run();
+    }
 
-        for(lastIndex = index; lastIndex < json.size(); lastIndex++) {
-            if (QString("0123456789+-.eE").indexOf(json[lastIndex]) == -1) {
-                break;
-            }
-        }
+    /**
+     * parseEvents
+     */
+    bool parseEvents(const QByteArray &json, JsonHandler &handler) {
+        return parseEvents(json.constData(), json.constData() + json.size(), handler);
+    }
 
-        return lastIndex -1;
+    /**
+     * parseUtf8
+     */
+    QVariant parseUtf8(const QByteArray &json) {
+        bool success = true;
+        return parseUtf8(json, success);
     }
 
     /**
-     * eatWhitespace
+     * parseUtf8
      */
-    static void eatWhitespace(const QString &json, int &index) {
-        for(; index < json.size(); index++) {
-            if (QString(" \t\n\r").indexOf(json[index]) == -1) {
-                break;
-            }
-        }
+    QVariant parseUtf8(const QByteArray &json, bool &success) {
+        VariantBuilder builder;
+        success = parseEvents(json, builder);
+        return success ? builder.result() : QVariant();
     }
 
     /**
-     * lookAhead
+     * parse
      */
-    static int lookAhead(const QString &json, int index) {
-        int saveIndex = index;
-        return nextToken(json, saveIndex);
+    QVariant parse(const QString &json) {
+        bool success = true;
+        return parse(json, success);
     }
 
     /**
-     * nextToken
+     * parse
      */
-    static int nextToken(const QString &json, int &index) {
-        eatWhitespace(json, index);
-
-        if (index == json.size()) {
-            return JsonTokenNone;
-        }
-
-        QChar c = json[index];
-        index++;
-        switch(c.toLatin1()) {
-            case '{': return JsonTokenCurlyOpen;
-            case '}': return JsonTokenCurlyClose;
-            case '[': return JsonTokenSquaredOpen;
-            case ']': return JsonTokenSquaredClose;
-            case ',': return JsonTokenComma;
-            case '"': return JsonTokenString;
-            case '0': case '1': case '2': case '3': case '4':
-            case '5': case '6': case '7': case '8': case '9':
-            case '-': return JsonTokenNumber;
-            case ':': return JsonTokenColon;
-        }
-        index--; // ^ WTF?
-
-        int remainingLength = json.size() - index;
-
-        // True
-        if (remainingLength >= 4) {
-            if (json[index] == 't' && json[index + 1] == 'r' &&
-                json[index + 2] == 'u' && json[index + 3] == 'e') {
-                index += 4;
-                return JsonTokenTrue;
+    QVariant parse(const QString &json, bool &success) {
+        if (json.isNull()) {
+            // a null string was never an error, it's the empty QVariant
+            success = true;
+            return QVariant();
+        }
+
+        // converting to UTF-8 once is cheaper than tokenizing UTF-16
+        QByteArray data = json.toUtf8();
+        VariantBuilder builder(VariantBuilder::LegacyNumbers);
+        EventParser parser(data.constData(), data.constData() + data.size(), builder, true);
+        success = parser.run();
+        return success ? builder.result() : QVariant();
+    }
+
+
+    JsonWriter::JsonWriter(Format format)
+        : m_Device(nullptr), m_Format(format), m_AfterKey(false), m_Error(false) {
+    }
+
+    JsonWriter::JsonWriter(QIODevice *device, Format format)
+        : m_Device(device), m_Format(format), m_AfterKey(false), m_Error(false) {
+        // a reserved buffer keeps its memory when it is emptied after a flush
+        m_Buffer.reserve(FlushThreshold * 2);
+    }
+
+    JsonWriter::~JsonWriter() {
+        flush();
+    }
+
+    bool JsonWriter::startObject() {
+        beforeValue();
+        m_Buffer.append('{');
+        Container container = { true };
+        m_Stack.push_back(container);
+        return !m_Error;
+    }
+
+    bool JsonWriter::endObject() {
+        return endContainer('}');
+    }
+
+    bool JsonWriter::startArray() {
+        beforeValue();
+        m_Buffer.append('[');
+        Container container = { true };
+        m_Stack.push_back(container);
+        return !m_Error;
+    }
+
+    bool JsonWriter::endArray() {
+        return endContainer(']');
+    }
+
+    bool JsonWriter::key(const char *data, int size) {
+        beforeValue();
+        appendEscaped(data, size);
+        m_Buffer.append(m_Format == Pretty ? ": " : ":");
+        m_AfterKey = true;
+        return !m_Error;
+    }
+
+    bool JsonWriter::key(const QString &name) {
+        beforeValue();
+        appendEscaped(name.constData(), name.size());
+        m_Buffer.append(m_Format == Pretty ? ": " : ":");
+        m_AfterKey = true;
+        return !m_Error;
+    }
+
+    bool JsonWriter::string(const char *data, int size) {
+        beforeValue();
+        appendEscaped(data, size);
+        return afterWrite();
+    }
+
+    bool JsonWriter::string(const QString &value) {
+        beforeValue();
+        appendEscaped(value.constData(), value.size());
+        return afterWrite();
+    }
+
+    bool JsonWriter::number(const char *data, int size) {
+        beforeValue();
+        m_Buffer.append(data, size);
+        return afterWrite();
+    }
+
+    bool JsonWriter::number(int value) {
+        return number(static_cast<qlonglong>(value));
+    }
+
+    bool JsonWriter::number(uint value) {
+        return number(static_cast<qulonglong>(value));
+    }
+
+    bool JsonWriter::number(qlonglong value) {
+        beforeValue();
+        m_Buffer.append(QByteArray::number(value));
+        return afterWrite();
+    }
+
+    bool JsonWriter::number(qulonglong value) {
+        beforeValue();
+        m_Buffer.append(QByteArray::number(value));
+        return afterWrite();
+    }
+
+    bool JsonWriter::number(double value) {
+        if (!std::isfinite(value)) {
+            m_Error = true;
+            return false;
+        }
+        beforeValue();
+        QByteArray text = QByteArray::number(value, 'g');
+        m_Buffer.append(text);
+        // keep it a floating point number when read back
+        if (!text.contains('.') && !text.contains('e')) {
+            m_Buffer.append(".0");
+        }
+        return afterWrite();
+    }
+
+    bool JsonWriter::boolean(bool value) {
+        beforeValue();
+        m_Buffer.append(value ? "true" : "false");
+        return afterWrite();
+    }
+
+    bool JsonWriter::null() {
+        beforeValue();
+        m_Buffer.append("null");
+        return afterWrite();
+    }
+
+    bool JsonWriter::variant(const QVariant &data) {
+        if (!data.isValid()) { // invalid or null?
+            return null();
+        } else if ((data.type() == QVariant::List) ||
+                   (data.type() == QVariant::StringList)) { // variant is a list?
+            startArray();
+            const QVariantList list = data.toList();
+            for (const QVariant &value : list) {
+                if (!variant(value)) {
+                    return false;
+                }
             }
+            return endArray();
+        } else if (data.type() == QVariant::Hash) { // variant is a hash?
+            return writeMap(*this, data.toHash()) && !m_Error;
+        } else if (data.type() == QVariant::Map) { // variant is a map?
+            return writeMap(*this, data.toMap()) && !m_Error;
+        } else if ((data.type() == QVariant::String) ||
+                   (data.type() == QVariant::ByteArray)) {// a string or a byte array?
+            return string(data.toString());
+        } else if (data.type() == QVariant::Double) { // double?
+            return number(data.toDouble());
+        } else if (data.type() == QVariant::Bool) { // boolean value?
+            return boolean(data.toBool());
+        } else if (data.type() == QVariant::ULongLong) { // large unsigned number?
+            return number(data.value<qulonglong>());
+        } else if (data.canConvert<qlonglong>()) { // any signed number?
+            return number(data.value<qlonglong>());
+        } else if (data.canConvert<QString>()) { // can value be converted to string?
+            // this will catch QDate, QDateTime, QUrl, ...
+            return string(data.toString());
         }
+        m_Error = true;
+        return false;
+    }
 
-        // False
-        if (remainingLength >= 5) {
-            if (json[index] == 'f' && json[index + 1] == 'a' &&
-                json[index + 2] == 'l' && json[index + 3] == 's' &&
-                json[index + 4] == 'e') {
-                index += 5;
-                return JsonTokenFalse;
+    bool JsonWriter::flush() {
+        if ((m_Device != nullptr) && !m_Buffer.isEmpty()) {
+            if (m_Device->write(m_Buffer.constData(), m_Buffer.size()) != m_Buffer.size()) {
+                m_Error = true;
             }
+            // not clear(), that would release the reserved memory
+            m_Buffer.resize(0);
         }
+        return !m_Error;
+    }
 
-        // Null
-        if (remainingLength >= 4) {
-            if (json[index] == 'n' && json[index + 1] == 'u' &&
-                json[index + 2] == 'l' && json[index + 3] == 'l') {
-                index += 4;
-                return JsonTokenNull;
+    void JsonWriter::beforeValue() {
+        if (m_AfterKey) {
+            m_AfterKey = false;
+            return;
+        }
+        if (m_Stack.empty()) {
+            return;
+        }
+        if (!m_Stack.back().empty) {
+            m_Buffer.append(',');
+        }
+        m_Stack.back().empty = false;
+        newLine();
+    }
+
+    void JsonWriter::newLine() {
+        if (m_Format == Pretty) {
+            m_Buffer.append('\n');
+            m_Buffer.append(QByteArray(static_cast<int>(m_Stack.size()) * 4, ' '));
+        }
+    }
+
+    bool JsonWriter::endContainer(char close) {
+        bool empty = m_Stack.back().empty;
+        m_Stack.pop_back();
+        if (!empty) {
+            newLine();
+        }
+        m_Buffer.append(close);
+        return afterWrite();
+    }
+
+    bool JsonWriter::afterWrite() {
+        if ((m_Device != nullptr) && (m_Buffer.size() >= FlushThreshold)) {
+            flush();
+        }
+        return !m_Error;
+    }
+
+    static const char hexDigits[] = "0123456789abcdef";
+
+    void JsonWriter::appendEscape(uint character) {
+        switch (character) {
+            case '"': m_Buffer.append("\\\""); break;
+            case '\\': m_Buffer.append("\\\\"); break;
+            case '\b': m_Buffer.append("\\b"); break;
+            case '\f': m_Buffer.append("\\f"); break;
+            case '\n': m_Buffer.append("\\n"); break;
+            case '\r': m_Buffer.append("\\r"); break;
+            case '\t': m_Buffer.append("\\t"); break;
+            default: {
+                // the remaining control characters
+                char escape[] = { '\\', 'u', '0', '0', hexDigits[character >> 4], hexDigits[character & 0xF] };
+                m_Buffer.append(escape, sizeof(escape));
             }
         }
+    }
 
-        return JsonTokenNone;
+    static bool needsEscape(uint character) {
+        return (character < 0x20) || (character == '"') || (character == '\\');
+    }
+
+    void JsonWriter::appendEscaped(const char *data, int size) {
+        // in a single pass, the text between characters that need escaping is copied in one piece
+        m_Buffer.append('"');
+        const char *end = data + size;
+        const char *start = data;
+        for (const char *pos = data; pos != end; ++pos) {
+            uint character = static_cast<unsigned char>(*pos);
+            if (needsEscape(character)) {
+                m_Buffer.append(start, static_cast<int>(pos - start));
+                appendEscape(character);
+                start = pos + 1;
+            }
+        }
+        m_Buffer.append(start, static_cast<int>(end - start));
+        m_Buffer.append('"');
+    }
+
+    void JsonWriter::appendEscaped(const QChar *data, int size) {
+        // encodes to UTF-8 and escapes in the same pass, without a temporary QByteArray
+        m_Buffer.append('"');
+        for (int i = 0; i < size; ++i) {
+            uint character = data[i].unicode();
+            if (character < 0x80) {
+                if (needsEscape(character)) {
+                    appendEscape(character);
+                } else {
+                    m_Buffer.append(static_cast<char>(character));
+                }
+            } else if (character < 0x800) {
+                m_Buffer.append(static_cast<char>(0xC0 | (character >> 6)));
+                m_Buffer.append(static_cast<char>(0x80 | (character & 0x3F)));
+            } else {
+                if (QChar::isHighSurrogate(character) && (i + 1 < size) && data[i + 1].isLowSurrogate()) {
+                    character = QChar::surrogateToUcs4(data[i], data[i + 1]);
+                    ++i;
+                    m_Buffer.append(static_cast<char>(0xF0 | (character >> 18)));
+                    m_Buffer.append(static_cast<char>(0x80 | ((character >> 12) & 0x3F)));
+                } else {
+                    // a surrogate without its other half can't be encoded, like the parser
+                    // substitute U+FFFD so the output stays valid UTF-8
+                    if (QChar::isSurrogate(character)) {
+                        character = 0xFFFD;
+                    }
+                    m_Buffer.append(static_cast<char>(0xE0 | (character >> 12)));
+                }
+                m_Buffer.append(static_cast<char>(0x80 | ((character >> 6) & 0x3F)));
+                m_Buffer.append(static_cast<char>(0x80 | (character & 0x3F)));
+            }
+        }
+        m_Buffer.append('"');
     }
 } //end namespace
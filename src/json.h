@@ -23,9 +23,13 @@
 #ifndef JSON_H
 #define JSON_H
 
+#include <QByteArray>
 #include <QVariant>
 #include <QString>
 
+#include <vector>
+
+class QIODevice;
 
 /**
  * \namespace QtJson
@@ -37,15 +41,412 @@ namespace QtJson {
     typedef QVariantMap JsonObject;
     typedef QVariantList JsonArray;
 
+    /**
+     * \brief Receives the content of a JSON document from parseEvents
+     *
+     * Every event returns false to stop parsing, i.e. once the fields a caller is interested
+     * in have been seen. Strings, keys and numbers are passed as UTF-8 text that is only
+     * valid until the event returns. Escape sequences in strings are already resolved,
+     * numbers are passed as they appear in the document. An escaped surrogate that
+     * isn't part of a pair is replaced by U+FFFD so strings are always valid UTF-8.
+     * The default implementations ignore the event.
+     */
+    class JsonHandler {
+    public:
+        virtual ~JsonHandler() {}
+
+        virtual bool startObject() { return true; }
+        virtual bool endObject() { return true; }
+        virtual bool startArray() { return true; }
+        virtual bool endArray() { return true; }
+
+        /**
+         * The name of the next value inside an object
+         */
+        virtual bool key(const char *data, int size) { Q_UNUSED(data); Q_UNUSED(size); return true; }
+
+        virtual bool string(const char *data, int size) { Q_UNUSED(data); Q_UNUSED(size); return true; }
+        virtual bool number(const char *data, int size) { Q_UNUSED(data); Q_UNUSED(size); return true; }
+        virtual bool boolean(bool value) { Q_UNUSED(value); return true; }
+        virtual bool null() { return true; }
+    };
+
+    /**
+     * Parse UTF-8 encoded JSON data and report its content to a handler, without
+     * converting it to UTF-16 or building a QVariant hierarchy
+     *
+     * \param begin Start of the JSON data
+     * \param end End of the JSON data
+     * \param handler Receives the content of the first value in the data
+     *
+     * \return true if the value was parsed completely, false if the data is invalid or
+     *         the handler stopped parsing
+     */
+    bool parseEvents(const char *begin, const char *end, JsonHandler &handler);
+
+    /**
+     * Parse UTF-8 encoded JSON data, see parseEvents
+     */
+    bool parseEvents(const QByteArray &json, JsonHandler &handler);
+
+    /**
+     * Parse UTF-8 encoded JSON data, i.e. a network reply, without converting it to a
+     * QString first
+     *
+     * \param json The JSON data
+     */
+    QVariant parseUtf8(const QByteArray &json);
+
+    /**
+     * Parse UTF-8 encoded JSON data
+     *
+     * \param json The JSON data
+     * \param success The success of the parsing
+     */
+    QVariant parseUtf8(const QByteArray &json, bool &success);
+
+    /**
+     * \brief Builds the same QVariant hierarchy as parseUtf8 from the events of parseEvents
+     *
+     * Numbers with a fraction or an exponent become double, integers become the smallest
+     * of int, uint, qlonglong and qulonglong that holds them and larger integers strings.
+     */
+    class VariantBuilder : public JsonHandler {
+    public:
+        enum Option {
+            NoOptions = 0,
+            // numbers without a '.' never become double, like parse(QString) always did.
+            // "1e5" becomes a string
+            LegacyNumbers = 1
+        };
+
+        explicit VariantBuilder(int options = NoOptions) : m_Options(options) {}
+
+        QVariant result() const { return m_Result; }
+
+        virtual bool startObject();
+        virtual bool endObject();
+        virtual bool startArray();
+        virtual bool endArray();
+        virtual bool key(const char *data, int size);
+        virtual bool string(const char *data, int size);
+        virtual bool number(const char *data, int size);
+        virtual bool boolean(bool value);
+        virtual bool null();
+
+    private:
+        struct Container {
+            bool isObject;
+            QVariantMap map;
+            QVariantList list;
+            QString key;
+        };
+
+        void add(const QVariant &value);
+
+        QVariant numberValue(const QByteArray &number) const;
+
+    private:
+        int m_Options;
+        std::vector<Container> m_Stack;
+        QVariant m_Result;
+    };
+
+    /**
+     * \brief Writes JSON text into a single growing buffer or straight to a QIODevice
+     *
+     * The document is written in order with the start/end, key and value calls. Commas,
+     * and in pretty mode line breaks and indentation, are inserted automatically. The
+     * calls have to form a valid document, this is not checked.
+     * As a JsonHandler a writer can be passed to parseEvents to reformat a document
+     * without building a QVariant hierarchy. Strings passed as UTF-8 have to be valid
+     * UTF-8, they are only escaped. In QStrings a surrogate that isn't part of a pair is
+     * written as U+FFFD.
+     * To write to a SafeWriteFile, pass file.operator->() as the device.
+     */
+    class JsonWriter : public JsonHandler {
+    public:
+        enum Format {
+            Compact,
+            // one value per line, indented by four spaces per level
+            Pretty
+        };
+
+        /**
+         * Write into a buffer, see data
+         */
+        explicit JsonWriter(Format format = Compact);
+
+        /**
+         * Stream to a device. Output is collected in a buffer that is written to the device
+         * whenever it grows beyond FlushThreshold, by flush and by the destructor
+         */
+        explicit JsonWriter(QIODevice *device, Format format = Compact);
+
+        ~JsonWriter();
+
+        static const int FlushThreshold = 64 * 1024;
+
+        virtual bool startObject();
+        virtual bool endObject();
+        virtual bool startArray();
+        virtual bool endArray();
+
+        virtual bool key(const char *data, int size);
+        bool key(const QString &name);
+
+        virtual bool string(const char *data, int size);
+        bool string(const QString &value);
+
+        /**
+         * Write a number that is already formatted, i.e. while reformatting a document
+         */
+        virtual bool number(const char *data, int size);
+        bool number(int value);
+        bool number(uint value);
+        bool number(qlonglong value);
+        bool number(qulonglong value);
+
+        /**
+         * Infinite and NaN values can't be represented in JSON and are an error
+         */
+        bool number(double value);
+
+        virtual bool boolean(bool value);
+        virtual bool null();
+
+        /**
+         * Write a QVariant hierarchy the way serialize does
+         *
+         * \return false if the data contains something that can't be represented in JSON
+         */
+        bool variant(const QVariant &data);
+
+        /**
+         * Write the buffered output to the device
+         *
+         * \return false if writing failed now or before
+         */
+        bool flush();
+
+        /**
+         * \return true if something couldn't be written
+         */
+        bool hasError() const { return m_Error; }
+
+        /**
+         * \return the document written so far if there is no device
+         */
+        const QByteArray &data() const { return m_Buffer; }
+
+    private:
+        struct Container {
+            bool empty;
+        };
+
+        void beforeValue();
+        void newLine();
+        bool endContainer(char close);
+        void appendEscaped(const char *data, int size);
+        void appendEscaped(const QChar *data, int size);
+        void appendEscape(uint character);
+        bool afterWrite();
+
+    private:
+        QIODevice *m_Device;
+        Format m_Format;
+        QByteArray m_Buffer;
+        std::vector<Container> m_Stack;
+        bool m_AfterKey;
+        bool m_Error;
+    };
+
+    class JsonDocument;
+
+    /**
+     * \brief A reference to a value inside a JsonDocument
+     *
+     * The reference is only valid as long as the document isn't destroyed, moved or
+     * parsed again. Looking up something that doesn't exist returns an undefined value,
+     * so lookups can be chained: doc.root()["files"][0]["name"].toString()
+     */
+    class JsonValue {
+    public:
+        enum Type {
+            Undefined,
+            Null,
+            Bool,
+            Number,
+            String,
+            Array,
+            Object
+        };
+
+        JsonValue();
+
+        Type type() const;
+
+        bool isUndefined() const { return type() == Undefined; }
+        bool isNull() const { return type() == Null; }
+        bool isBool() const { return type() == Bool; }
+        bool isNumber() const { return type() == Number; }
+        bool isString() const { return type() == String; }
+        bool isArray() const { return type() == Array; }
+        bool isObject() const { return type() == Object; }
+
+        bool toBool(bool defaultValue = false) const;
+        int toInt(int defaultValue = 0) const;
+        qlonglong toLongLong(qlonglong defaultValue = 0) const;
+        double toDouble(double defaultValue = 0.0) const;
+        QString toString(const QString &defaultValue = QString()) const;
+
+        /**
+         * The UTF-8 text of a string or the text of a number as it appears in the document,
+         * without copying. Not null-terminated
+         */
+        const char *textData() const;
+        int textSize() const;
+
+        /**
+         * \return number of elements of an array or members of an object
+         */
+        int size() const;
+
+        /**
+         * \return element of an array or value of a member of an object, in document order
+         */
+        JsonValue at(int index) const;
+        JsonValue operator[](int index) const { return at(index); }
+
+        /**
+         * \return name of a member of an object, in document order
+         */
+        QString keyAt(int index) const;
+
+        /**
+         * Look up a member of an object. If a name appears more than once, the first
+         * member is returned
+         *
+         * \param key UTF-8 encoded name
+         */
+        JsonValue value(const char *key, int size) const;
+        JsonValue value(const char *key) const;
+        JsonValue value(const QString &key) const;
+        JsonValue operator[](const char *key) const { return value(key); }
+        JsonValue operator[](const QString &key) const { return value(key); }
+
+        bool contains(const char *key) const { return !value(key).isUndefined(); }
+
+        /**
+         * Convert this value and everything below it to the QVariant hierarchy parse
+         * would have returned for it
+         */
+        QVariant toVariant() const;
+
+        /**
+         * Report this value and everything below it to a handler as parseEvents would,
+         * i.e. to write it with a JsonWriter
+         */
+        bool write(JsonHandler &handler) const;
+
+    private:
+        friend class JsonDocument;
+
+        JsonValue(const JsonDocument *document, quint32 index);
+
+    private:
+        const JsonDocument *m_Document;
+        quint32 m_Index;
+    };
+
+    /**
+     * \brief A parsed JSON document that converts to QVariant only on request
+     *
+     * All values of the document are stored in one array, the elements of arrays and
+     * objects as indices in a second one. Strings and numbers refer to the source data
+     * which the document keeps a reference to. Only strings with escape sequences are
+     * copied. Objects are kept in document order and searched linearly unless the
+     * document is parsed with HashObjects.
+     */
+    class JsonDocument {
+    public:
+        enum Option {
+            NoOptions = 0x00,
+            // objects with at least HashThreshold members get a hash table for value()
+            HashObjects = 0x01
+        };
+
+        static const int HashThreshold = 8;
+
+        JsonDocument();
+
+        /**
+         * Parse UTF-8 encoded JSON data, replacing the previous content
+         *
+         * \param json The JSON data. It is shared, not copied
+         * \param options Combination of Option flags
+         * \return true on success, the document is empty otherwise
+         */
+        bool parse(const QByteArray &json, int options = NoOptions);
+
+        bool isEmpty() const { return m_Values.empty(); }
+
+        /**
+         * \return the top level value, undefined if the document is empty
+         */
+        JsonValue root() const;
+
+    private:
+        friend class JsonValue;
+        friend class DocumentBuilder;
+
+        struct Value {
+            // strings and numbers: position of the text in m_Source or m_Strings
+            // arrays and objects: position of the elements in m_Links
+            quint32 offset;
+            // length of the text or number of elements
+            quint32 size;
+            // position of the hash table of an object in m_Links or NoTable
+            quint32 table;
+            quint8 type;
+            // the value of a bool or, for strings, whether the text is in m_Strings
+            bool flag;
+        };
+
+        static const quint32 NoTable = 0xFFFFFFFFu;
+
+        const char *text(const Value &value) const;
+        quint32 lookup(const Value &object, const char *key, int size) const;
+        void buildTable(Value &object);
+
+        static quint32 hashKey(const char *key, int size);
+        static quint32 tableCapacity(quint32 size);
+
+    private:
+        QByteArray m_Source;
+        // strings that had escape sequences
+        QByteArray m_Strings;
+        std::vector<Value> m_Values;
+        // array elements, key/value pairs of objects and hash tables
+        std::vector<quint32> m_Links;
+    };
+
     /**
      * Parse a JSON string
      *
+     * This is as lenient as it has always been, unlike parseUtf8 and parseEvents which
+     * only accept valid JSON: commas between values may be missing or repeated, also
+     * before a closing bracket, unknown escape sequences are dropped and numbers only
+     * become double if they contain a '.' (see VariantBuilder::LegacyNumbers).
+     * An escaped surrogate that isn't part of a pair is replaced by U+FFFD.
+     * A null string parses successfully to the empty QVariant.
+     *
      * \param json The JSON data
      */
     QVariant parse(const QString &json);
 
     /**
-     * Parse a JSON string
+     * Parse a JSON string, see parse(const QString&) for what it accepts
      *
      * \param json The JSON data
      * \param success The success of the parsing
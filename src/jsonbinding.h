@@ -0,0 +1,610 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+/**
+ * \file jsonbinding.h
+ */
+
+#ifndef JSONBINDING_H
+#define JSONBINDING_H
+
+#include "json.h"
+
+#include <QByteArray>
+#include <QString>
+#include <QVariant>
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <type_traits>
+
+/**
+ * Reading and writing plain structs as JSON without a QVariant in between.
+ *
+ * A struct lists its fields once by specializing JsonBinding in the QtJson namespace:
+ *
+ *   template<> struct JsonBinding<Foo> {
+ *       static const JsonLayout layout = JsonObjectLayout;
+ *
+ *       template<typename Visitor>
+ *       static void fields(Visitor &visitor) {
+ *           visitor.field("name", &Foo::name);
+ *           visitor.field("size", &Foo::size);
+ *       }
+ *   };
+ *
+ * parseStruct then fills a Foo directly from the parser events and serializeStruct
+ * writes one with a JsonWriter. Fields can be numbers, bool, QString, QVariant,
+ * QVariantMap, QVariantList or other bound structs. Further types are supported by
+ * specializing JsonConverter.
+ */
+namespace QtJson {
+    enum JsonLayout {
+        // the fields are the members of an object, found by name
+        JsonObjectLayout,
+        // the fields are the elements of an array, in the order they are listed
+        JsonArrayLayout
+    };
+
+    /**
+     * Specialized for every bound struct, see above
+     */
+    template<typename T>
+    struct JsonBinding;
+
+    /**
+     * \brief A string, number, bool or null value as reported by the parser
+     */
+    struct JsonScalar {
+        JsonValue::Type type;
+        // text of a string or number, UTF-8 and not null-terminated
+        const char *data;
+        int size;
+        bool boolean;
+
+        /**
+         * Report the value to a handler again
+         */
+        bool replay(JsonHandler &handler) const {
+            switch (type) {
+                case JsonValue::String: return handler.string(data, size);
+                case JsonValue::Number: return handler.number(data, size);
+                case JsonValue::Bool: return handler.boolean(boolean);
+                default: return handler.null();
+            }
+        }
+    };
+
+    template<typename T>
+    class BindingReader;
+
+    template<typename T>
+    bool writeBinding(JsonWriter &writer, const T &source);
+
+    /**
+     * \brief Converts between JSON and one field type
+     *
+     * read is called for scalar values. reader is called for objects and arrays and
+     * returns a handler that receives all events of that value or null to skip it.
+     * Values of the wrong type are skipped and leave the field unchanged.
+     * Types without a specialization are treated as bound structs.
+     */
+    template<typename T, typename Enable = void>
+    struct JsonConverter {
+        static bool read(const JsonScalar &value, T &target) {
+            Q_UNUSED(value); Q_UNUSED(target);
+            return false;
+        }
+
+        static std::unique_ptr<JsonHandler> reader(T &target) {
+            return std::unique_ptr<JsonHandler>(new BindingReader<T>(target));
+        }
+
+        static bool write(JsonWriter &writer, const T &value) {
+            return writeBinding(writer, value);
+        }
+    };
+
+    /**
+     * Integers, also read from strings and numbers with a fraction as QVariant::toInt does.
+     * Values that don't fit into T are skipped
+     */
+    template<typename T>
+    struct JsonConverter<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+        static bool read(const JsonScalar &value, T &target) {
+            if ((value.type != JsonValue::Number) && (value.type != JsonValue::String)) {
+                return false;
+            }
+            QByteArray text = QByteArray::fromRawData(value.data, value.size);
+            bool ok;
+            if (std::is_signed<T>::value) {
+                qlonglong number = text.toLongLong(&ok);
+                if (ok) {
+                    if ((number < static_cast<qlonglong>(std::numeric_limits<T>::min()))
+                        || (number > static_cast<qlonglong>(std::numeric_limits<T>::max()))) {
+                        return false;
+                    }
+                    target = static_cast<T>(number);
+                }
+            } else {
+                qulonglong number = text.toULongLong(&ok);
+                if (ok) {
+                    if (number > static_cast<qulonglong>(std::numeric_limits<T>::max())) {
+                        return false;
+                    }
+                    target = static_cast<T>(number);
+                }
+            }
+            if (!ok) {
+                double number = std::trunc(text.toDouble(&ok));
+                // max() of a 64 bit type rounds up to 2^63 or 2^64 as a double, so compare
+                // against the first value that doesn't fit
+                ok = ok && (number >= static_cast<double>(std::numeric_limits<T>::min()))
+                        && (number < static_cast<double>(std::numeric_limits<T>::max()) + 1.0);
+                if (ok) {
+                    target = static_cast<T>(number);
+                }
+            }
+            return ok;
+        }
+
+        static std::unique_ptr<JsonHandler> reader(T &target) {
+            Q_UNUSED(target);
+            return std::unique_ptr<JsonHandler>();
+        }
+
+        static bool write(JsonWriter &writer, const T &value) {
+            if (std::is_signed<T>::value) {
+                return writer.number(static_cast<qlonglong>(value));
+            } else {
+                return writer.number(static_cast<qulonglong>(value));
+            }
+        }
+    };
+
+    template<typename T>
+    struct JsonConverter<T, typename std::enable_if<std::is_floating_point<T>::value>::type> {
+        static bool read(const JsonScalar &value, T &target) {
+            if ((value.type != JsonValue::Number) && (value.type != JsonValue::String)) {
+                return false;
+            }
+            bool ok;
+            double number = QByteArray::fromRawData(value.data, value.size).toDouble(&ok);
+            if (ok) {
+                target = static_cast<T>(number);
+            }
+            return ok;
+        }
+
+        static std::unique_ptr<JsonHandler> reader(T &target) {
+            Q_UNUSED(target);
+            return std::unique_ptr<JsonHandler>();
+        }
+
+        static bool write(JsonWriter &writer, const T &value) {
+            return writer.number(static_cast<double>(value));
+        }
+    };
+
+    template<>
+    struct JsonConverter<bool> {
+        static bool read(const JsonScalar &value, bool &target) {
+            if (value.type == JsonValue::Bool) {
+                target = value.boolean;
+                return true;
+            } else if (value.type == JsonValue::Number) {
+                target = QByteArray::fromRawData(value.data, value.size).toDouble() != 0.0;
+                return true;
+            }
+            return false;
+        }
+
+        static std::unique_ptr<JsonHandler> reader(bool &target) {
+            Q_UNUSED(target);
+            return std::unique_ptr<JsonHandler>();
+        }
+
+        static bool write(JsonWriter &writer, const bool &value) {
+            return writer.boolean(value);
+        }
+    };
+
+    /**
+     * Strings, numbers and bools are read as their text, null as an empty string
+     */
+    template<>
+    struct JsonConverter<QString> {
+        static bool read(const JsonScalar &value, QString &target) {
+            switch (value.type) {
+                case JsonValue::String: target = QString::fromUtf8(value.data, value.size); break;
+                case JsonValue::Number: target = QString::fromLatin1(value.data, value.size); break;
+                case JsonValue::Bool: target = QString(value.boolean ? "true" : "false"); break;
+                default: target.clear(); break;
+            }
+            return true;
+        }
+
+        static std::unique_ptr<JsonHandler> reader(QString &target) {
+            Q_UNUSED(target);
+            return std::unique_ptr<JsonHandler>();
+        }
+
+        static bool write(JsonWriter &writer, const QString &value) {
+            return writer.string(value);
+        }
+    };
+
+    /**
+     * \brief Builds a QVariant hierarchy for one value and stores it in a field once complete
+     */
+    template<typename T>
+    class VariantReader : public VariantBuilder {
+    public:
+        explicit VariantReader(T &target)
+            : m_Target(target), m_Depth(0) {
+        }
+
+        virtual bool startObject() {
+            ++m_Depth;
+            return VariantBuilder::startObject();
+        }
+
+        virtual bool endObject() {
+            return VariantBuilder::endObject() && finish();
+        }
+
+        virtual bool startArray() {
+            ++m_Depth;
+            return VariantBuilder::startArray();
+        }
+
+        virtual bool endArray() {
+            return VariantBuilder::endArray() && finish();
+        }
+
+    private:
+        bool finish() {
+            if (--m_Depth == 0) {
+                // a QVariantMap field skips an array and a QVariantList field an object
+                QVariant value = result();
+                if (std::is_same<T, QVariant>::value || (value.userType() == qMetaTypeId<T>())) {
+                    m_Target = value.template value<T>();
+                }
+            }
+            return true;
+        }
+
+    private:
+        T &m_Target;
+        int m_Depth;
+    };
+
+    template<>
+    struct JsonConverter<QVariant> {
+        static bool read(const JsonScalar &value, QVariant &target) {
+            VariantBuilder builder;
+            value.replay(builder);
+            target = builder.result();
+            return true;
+        }
+
+        static std::unique_ptr<JsonHandler> reader(QVariant &target) {
+            return std::unique_ptr<JsonHandler>(new VariantReader<QVariant>(target));
+        }
+
+        static bool write(JsonWriter &writer, const QVariant &value) {
+            return writer.variant(value);
+        }
+    };
+
+    /**
+     * QVariantMap and QVariantList, null reads as an empty container
+     */
+    template<typename T>
+    struct JsonConverter<T, typename std::enable_if<std::is_same<T, QVariantMap>::value ||
+                                                    std::is_same<T, QVariantList>::value>::type> {
+        static bool read(const JsonScalar &value, T &target) {
+            if (value.type == JsonValue::Null) {
+                target.clear();
+                return true;
+            }
+            return false;
+        }
+
+        static std::unique_ptr<JsonHandler> reader(T &target) {
+            return std::unique_ptr<JsonHandler>(new VariantReader<T>(target));
+        }
+
+        static bool write(JsonWriter &writer, const T &value) {
+            return writer.variant(QVariant(value));
+        }
+    };
+
+
+    /**
+     * \brief Fills a bound struct from the events of parseEvents
+     *
+     * Fields that aren't in the document keep their value, values that don't belong
+     * to a field are skipped.
+     */
+    template<typename T>
+    class BindingReader : public JsonHandler {
+    public:
+        explicit BindingReader(T &target)
+            : m_Target(target), m_Started(false), m_Field(-1), m_Nested(nullptr), m_NestedDepth(0) {
+        }
+
+        virtual bool startObject() {
+            return startContainer(JsonObjectLayout);
+        }
+
+        virtual bool endObject() {
+            return endContainer(JsonObjectLayout);
+        }
+
+        virtual bool startArray() {
+            return startContainer(JsonArrayLayout);
+        }
+
+        virtual bool endArray() {
+            return endContainer(JsonArrayLayout);
+        }
+
+        virtual bool key(const char *data, int size) {
+            if (m_Nested != nullptr) {
+                return m_Nested->key(data, size);
+            }
+            FieldIndex visitor(data, size);
+            JsonBinding<T>::fields(visitor);
+            m_Field = visitor.result();
+            return true;
+        }
+
+        virtual bool string(const char *data, int size) {
+            JsonScalar value = { JsonValue::String, data, size, false };
+            return scalar(value);
+        }
+
+        virtual bool number(const char *data, int size) {
+            JsonScalar value = { JsonValue::Number, data, size, false };
+            return scalar(value);
+        }
+
+        virtual bool boolean(bool value) {
+            JsonScalar scalarValue = { JsonValue::Bool, nullptr, 0, value };
+            return scalar(scalarValue);
+        }
+
+        virtual bool null() {
+            JsonScalar value = { JsonValue::Null, nullptr, 0, false };
+            return scalar(value);
+        }
+
+    private:
+        // finds the index of the field with a name
+        class FieldIndex {
+        public:
+            FieldIndex(const char *key, int size)
+                : m_Key(key), m_Size(size), m_Current(0), m_Result(-1) {
+            }
+
+            template<typename F>
+            void field(const char *name, F T::*member) {
+                Q_UNUSED(member);
+                if ((m_Result == -1) && (std::strlen(name) == static_cast<size_t>(m_Size)) &&
+                    (std::memcmp(name, m_Key, m_Size) == 0)) {
+                    m_Result = m_Current;
+                }
+                ++m_Current;
+            }
+
+            int result() const { return m_Result; }
+
+        private:
+            const char *m_Key;
+            int m_Size;
+            int m_Current;
+            int m_Result;
+        };
+
+        // passes a scalar value to the converter of a field
+        class ScalarField {
+        public:
+            ScalarField(T &target, int index, const JsonScalar &value)
+                : m_Target(target), m_Index(index), m_Current(0), m_Value(value) {
+            }
+
+            template<typename F>
+            void field(const char *name, F T::*member) {
+                Q_UNUSED(name);
+                if (m_Current++ == m_Index) {
+                    JsonConverter<F>::read(m_Value, m_Target.*member);
+                }
+            }
+
+        private:
+            T &m_Target;
+            int m_Index;
+            int m_Current;
+            const JsonScalar &m_Value;
+        };
+
+        // creates the handler for an object or array value of a field
+        class ContainerField {
+        public:
+            ContainerField(T &target, int index)
+                : m_Target(target), m_Index(index), m_Current(0) {
+            }
+
+            template<typename F>
+            void field(const char *name, F T::*member) {
+                Q_UNUSED(name);
+                if (m_Current++ == m_Index) {
+                    m_Result = JsonConverter<F>::reader(m_Target.*member);
+                }
+            }
+
+            std::unique_ptr<JsonHandler> &result() { return m_Result; }
+
+        private:
+            T &m_Target;
+            int m_Index;
+            int m_Current;
+            std::unique_ptr<JsonHandler> m_Result;
+        };
+
+        bool startContainer(JsonLayout layout) {
+            if (m_Nested == nullptr) {
+                if (!m_Started) {
+                    // the struct itself
+                    m_Started = true;
+                    m_Field = 0;
+                    return layout == JsonBinding<T>::layout;
+                }
+                ContainerField visitor(m_Target, m_Field);
+                JsonBinding<T>::fields(visitor);
+                m_Owned = std::move(visitor.result());
+                // the default handler ignores everything
+                m_Nested = m_Owned ? m_Owned.get() : &m_Skip;
+            }
+            ++m_NestedDepth;
+            return layout == JsonObjectLayout ? m_Nested->startObject() : m_Nested->startArray();
+        }
+
+        bool endContainer(JsonLayout layout) {
+            if (m_Nested == nullptr) {
+                // end of the struct
+                return true;
+            }
+            bool ok = layout == JsonObjectLayout ? m_Nested->endObject() : m_Nested->endArray();
+            if (--m_NestedDepth == 0) {
+                m_Nested = nullptr;
+                m_Owned.reset();
+                nextField();
+            }
+            return ok;
+        }
+
+        bool scalar(const JsonScalar &value) {
+            if (m_Nested != nullptr) {
+                return value.replay(*m_Nested);
+            }
+            if (!m_Started) {
+                // only an object or an array can hold the struct
+                return false;
+            }
+            ScalarField visitor(m_Target, m_Field, value);
+            JsonBinding<T>::fields(visitor);
+            nextField();
+            return true;
+        }
+
+        void nextField() {
+            // in objects the next key selects the field
+            m_Field = JsonBinding<T>::layout == JsonArrayLayout ? m_Field + 1 : -1;
+        }
+
+    private:
+        T &m_Target;
+        bool m_Started;
+        int m_Field;
+        JsonHandler *m_Nested;
+        int m_NestedDepth;
+        std::unique_ptr<JsonHandler> m_Owned;
+        JsonHandler m_Skip;
+    };
+
+    /**
+     * \brief Writes the fields of a bound struct
+     */
+    template<typename T>
+    class BindingWriter {
+    public:
+        BindingWriter(JsonWriter &writer, const T &source)
+            : m_Writer(writer), m_Source(source), m_Success(true) {
+        }
+
+        template<typename F>
+        void field(const char *name, F T::*member) {
+            if (JsonBinding<T>::layout == JsonObjectLayout) {
+                m_Writer.key(name, static_cast<int>(std::strlen(name)));
+            }
+            m_Success = JsonConverter<F>::write(m_Writer, m_Source.*member) && m_Success;
+        }
+
+        bool success() const { return m_Success; }
+
+    private:
+        JsonWriter &m_Writer;
+        const T &m_Source;
+        bool m_Success;
+    };
+
+    template<typename T>
+    bool writeBinding(JsonWriter &writer, const T &source) {
+        bool object = JsonBinding<T>::layout == JsonObjectLayout;
+        if (object) {
+            writer.startObject();
+        } else {
+            writer.startArray();
+        }
+        BindingWriter<T> visitor(writer, source);
+        JsonBinding<T>::fields(visitor);
+        bool ok = object ? writer.endObject() : writer.endArray();
+        return visitor.success() && ok;
+    }
+
+    /**
+     * Fill a bound struct from UTF-8 encoded JSON data
+     *
+     * \param json The JSON data
+     * \param target The struct to fill. Fields not in the data keep their value, on
+     *               failure the fields before the error are filled
+     * \return true on success
+     */
+    template<typename T>
+    bool parseStruct(const QByteArray &json, T &target) {
+        BindingReader<T> reader(target);
+        return parseEvents(json, reader);
+    }
+
+    /**
+     * Write a bound struct to a writer, i.e. as part of a larger document
+     */
+    template<typename T>
+    bool serializeStruct(const T &source, JsonWriter &writer) {
+        return writeBinding(writer, source);
+    }
+
+    /**
+     * Generate the JSON representation of a bound struct
+     *
+     * \return UTF-8 encoded JSON, empty if a field can't be represented in JSON
+     */
+    template<typename T>
+    QByteArray serializeStruct(const T &source, JsonWriter::Format format = JsonWriter::Compact) {
+        JsonWriter writer(format);
+        return writeBinding(writer, source) ? writer.data() : QByteArray();
+    }
+}
+
+#endif // JSONBINDING_H
@@ -1,5 +1,59 @@
 #include "modrepositoryfileinfo.h"
-#include "json.h"
+#include "jsonbinding.h"
+
+
+namespace QtJson {
+
+template<>
+struct JsonConverter<MOBase::VersionInfo> {
+  static bool read(const JsonScalar &value, MOBase::VersionInfo &target)
+  {
+    if (value.type != JsonValue::String) {
+      return false;
+    }
+    target.parse(QString::fromUtf8(value.data, value.size));
+    return true;
+  }
+
+  static std::unique_ptr<JsonHandler> reader(MOBase::VersionInfo&)
+  {
+    return std::unique_ptr<JsonHandler>();
+  }
+
+  static bool write(JsonWriter &writer, const MOBase::VersionInfo &value)
+  {
+    return writer.string(value.canonicalString());
+  }
+};
+
+// stored as an array, the field order must not change
+template<>
+struct JsonBinding<MOBase::ModRepositoryFileInfo> {
+  static const JsonLayout layout = JsonArrayLayout;
+
+  template<typename Visitor>
+  static void fields(Visitor &visitor)
+  {
+    using MOBase::ModRepositoryFileInfo;
+    visitor.field("gameName",      &ModRepositoryFileInfo::gameName);
+    visitor.field("fileID",        &ModRepositoryFileInfo::fileID);
+    visitor.field("name",          &ModRepositoryFileInfo::name);
+    visitor.field("uri",           &ModRepositoryFileInfo::uri);
+    visitor.field("version",       &ModRepositoryFileInfo::version);
+    visitor.field("description",   &ModRepositoryFileInfo::description);
+    visitor.field("categoryID",    &ModRepositoryFileInfo::categoryID);
+    visitor.field("fileSize",      &ModRepositoryFileInfo::fileSize);
+    visitor.field("modID",         &ModRepositoryFileInfo::modID);
+    visitor.field("modName",       &ModRepositoryFileInfo::modName);
+    visitor.field("newestVersion", &ModRepositoryFileInfo::newestVersion);
+    visitor.field("fileName",      &ModRepositoryFileInfo::fileName);
+    visitor.field("fileCategory",  &ModRepositoryFileInfo::fileCategory);
+    visitor.field("repository",    &ModRepositoryFileInfo::repository);
+    visitor.field("userData",      &ModRepositoryFileInfo::userData);
+  }
+};
+
+}
 
 
 MOBase::ModRepositoryFileInfo::ModRepositoryFileInfo(const ModRepositoryFileInfo &reference)
@@ -22,29 +76,10 @@ MOBase::ModRepositoryFileInfo::ModRepositoryFileInfo(QString gameName, int modID
 
 MOBase::ModRepositoryFileInfo MOBase::ModRepositoryFileInfo::createFromJson(const QString &data)
 {
-  QVariantList result = QtJson::parse(data).toList();
-
-  while (result.length() < 15) {
-    result.append(QVariant());
-  }
-
   ModRepositoryFileInfo newInfo;
 
-  newInfo.gameName     = result.at(0).toString();
-  newInfo.fileID       = result.at(1).toInt();
-  newInfo.name         = result.at(2).toString();
-  newInfo.uri          = result.at(3).toString();
-  newInfo.version.parse(result.at(4).toString());
-  newInfo.description  = result.at(5).toString();
-  newInfo.categoryID   = result.at(6).toInt();
-  newInfo.fileSize     = result.at(7).toInt();
-  newInfo.modID        = result.at(8).toInt();
-  newInfo.modName      = result.at(9).toString();
-  newInfo.newestVersion.parse(result.at(10).toString());
-  newInfo.fileName     = result.at(11).toString();
-  newInfo.fileCategory = result.at(12).toInt();
-  newInfo.repository   = result.at(13).toString();
-  newInfo.userData     = result.at(14).toMap();
+  // fields missing from the data keep their defaults
+  QtJson::parseStruct(data.toUtf8(), newInfo);
 
   return newInfo;
 }
@@ -52,20 +87,5 @@ MOBase::ModRepositoryFileInfo MOBase::ModRepositoryFileInfo::createFromJson(cons
 
 QString MOBase::ModRepositoryFileInfo::toString() const
 {
-  return QString("[ \"%1\",%2,\"%3\",\"%4\",\"%5\",\"%6\",%7,%8,%9,\"%10\",\"%11\",\"%12\",%13,\"%14\",%15 ]")
-            .arg(gameName)
-            .arg(fileID)
-            .arg(name)
-            .arg(uri)
-            .arg(version.canonicalString())
-            .arg(description.mid(0).replace("\"", "'"))
-            .arg(categoryID)
-            .arg(fileSize)
-            .arg(modID)
-            .arg(modName)
-            .arg(newestVersion.canonicalString())
-            .arg(fileName)
-            .arg(fileCategory)
-            .arg(repository)
-            .arg(QString(QtJson::serialize(userData)));
+  return QString::fromUtf8(QtJson::serializeStruct(*this));
 }
@@ -19,5 +19,89 @@ along with Mod Organizer.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "mytree.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
 namespace MOBase {
+
+
+// nodes allocated through allocateNode are preceded by a header holding a reference to
+// their arena. The header is padded so the node itself stays suitably aligned
+static const std::size_t NodeHeaderSize =
+    ((sizeof(std::shared_ptr<TreeArena>) + alignof(std::max_align_t) - 1)
+     / alignof(std::max_align_t)) * alignof(std::max_align_t);
+
+
+TreeArena::TreeArena(std::size_t blockSize)
+  : m_BlockSize(blockSize)
+  , m_Current(nullptr)
+  , m_Remaining(0)
+  , m_BytesReserved(0)
+{
+}
+
+
+TreeArena::~TreeArena()
+{
+  for (char *block : m_Blocks) {
+    delete [] block;
+  }
+}
+
+
+void *TreeArena::allocate(std::size_t size, std::size_t alignment)
+{
+  std::size_t padding = (alignment - reinterpret_cast<std::uintptr_t>(m_Current) % alignment) % alignment;
+  if ((m_Current == nullptr) || (padding + size > m_Remaining)) {
+    // oversized requests get a block of their own so the remainder of the current one isn't wasted
+    std::size_t blockSize = std::max(m_BlockSize, size + alignment);
+    char *block = new char[blockSize];
+    m_Blocks.push_back(block);
+    m_BytesReserved += blockSize;
+    if (blockSize > m_BlockSize) {
+      std::size_t offset = (alignment - reinterpret_cast<std::uintptr_t>(block) % alignment) % alignment;
+      return block + offset;
+    }
+    m_Current = block;
+    m_Remaining = blockSize;
+    padding = (alignment - reinterpret_cast<std::uintptr_t>(m_Current) % alignment) % alignment;
+  }
+  char *result = m_Current + padding;
+  m_Current = result + size;
+  m_Remaining -= padding + size;
+  return result;
+}
+
+
+void *TreeArena::allocateNode(std::size_t size, const std::shared_ptr<TreeArena> &arena)
+{
+  void *block;
+  if (arena) {
+    block = arena->allocate(NodeHeaderSize + size, alignof(std::max_align_t));
+  } else {
+    block = ::operator new(NodeHeaderSize + size);
+  }
+  new (block) std::shared_ptr<TreeArena>(arena);
+  return static_cast<char*>(block) + NodeHeaderSize;
+}
+
+
+void TreeArena::deallocateNode(void *ptr)
+{
+  if (ptr == nullptr) {
+    return;
+  }
+  void *block = static_cast<char*>(ptr) - NodeHeaderSize;
+  std::shared_ptr<TreeArena> *header = static_cast<std::shared_ptr<TreeArena>*>(block);
+  // move the reference out of the header first, releasing it may free the arena and with it
+  // the memory of the header
+  std::shared_ptr<TreeArena> arena = std::move(*header);
+  header->~shared_ptr<TreeArena>();
+  if (!arena) {
+    ::operator delete(block);
+  }
+}
+
+
 } // namespace MOBase
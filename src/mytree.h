@@ -26,50 +26,313 @@ Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
 
 #include <QString>
 
+#include <cstddef>
+#include <functional>
 #include <list>
+#include <memory>
 #include <set>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
+#include <vector>
 
 namespace MOBase {
 
 
+/**
+ * a monotonic allocator that carves memory from a few large blocks. Individual allocations
+ * are never returned, everything is released at once when the arena is destroyed.
+ * Trees created with an arena share ownership of it so the arena stays alive for as long as
+ * any node allocated from it.
+ * @note an arena is not thread safe, use a separate arena per thread
+ **/
+class QDLLEXPORT TreeArena
+{
+
+public:
+
+  static const std::size_t DefaultBlockSize = 64 * 1024;
+
+public:
+
+  explicit TreeArena(std::size_t blockSize = DefaultBlockSize);
+
+  ~TreeArena();
+
+  /**
+   * @brief allocate memory from the arena
+   *
+   * @param size number of bytes to allocate
+   * @param alignment required alignment of the returned memory
+   * @return pointer to the allocated memory. This is never nullptr
+   **/
+  void *allocate(std::size_t size, std::size_t alignment);
+
+  /**
+   * @return the number of bytes reserved from the system for this arena
+   **/
+  std::size_t bytesReserved() const { return m_BytesReserved; }
+
+  /**
+   * @brief allocate storage for a tree node, either from an arena or from the heap
+   *
+   * @param size size of the node
+   * @param arena the arena to allocate from. If this is empty, the node is allocated on the heap
+   * @return pointer to the storage for the node
+   **/
+  static void *allocateNode(std::size_t size, const std::shared_ptr<TreeArena> &arena);
+
+  /**
+   * @brief release storage allocated with allocateNode
+   **/
+  static void deallocateNode(void *ptr);
+
+private:
+
+  TreeArena(const TreeArena &reference);
+  TreeArena &operator=(const TreeArena &reference);
+
+private:
+
+  std::size_t m_BlockSize;
+  std::vector<char*> m_Blocks;
+  char *m_Current;
+  std::size_t m_Remaining;
+  std::size_t m_BytesReserved;
+
+};
+
+
+/**
+ * std-compatible allocator that allocates from a TreeArena or from the heap if no arena
+ * is set. The allocator doesn't keep the arena alive, the owner of the container has to
+ **/
+template <typename T>
+class TreeArenaAllocator
+{
+
+public:
+
+  typedef T value_type;
+
+  template <typename U>
+  struct rebind { typedef TreeArenaAllocator<U> other; };
+
+public:
+
+  TreeArenaAllocator(TreeArena *arena = nullptr) : m_Arena(arena) {}
+
+  template <typename U>
+  TreeArenaAllocator(const TreeArenaAllocator<U> &reference) : m_Arena(reference.arena()) {}
+
+  T *allocate(std::size_t n) {
+    if (m_Arena == nullptr) {
+      return static_cast<T*>(::operator new(n * sizeof(T)));
+    } else {
+      return static_cast<T*>(m_Arena->allocate(n * sizeof(T), alignof(T)));
+    }
+  }
+
+  void deallocate(T *ptr, std::size_t) {
+    // memory from an arena is only released with the arena itself
+    if (m_Arena == nullptr) {
+      ::operator delete(ptr);
+    }
+  }
+
+  TreeArena *arena() const { return m_Arena; }
+
+private:
+
+  TreeArena *m_Arena;
+
+};
+
+template <typename T, typename U>
+bool operator==(const TreeArenaAllocator<T> &lhs, const TreeArenaAllocator<U> &rhs)
+{
+  return lhs.arena() == rhs.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const TreeArenaAllocator<T> &lhs, const TreeArenaAllocator<U> &rhs)
+{
+  return lhs.arena() != rhs.arena();
+}
+
+
+/**
+ * summary of the leafs in a subtree, see MyTree::aggregate. Leafs are summarized through a
+ * function leafAggregate(const LeafT&) found by argument dependent lookup, which assigns each
+ * leaf a size and one of NumClasses classes (i.e. by file extension for a DirectoryTree)
+ **/
+class TreeAggregate
+{
+
+public:
+
+  static const int NumClasses = 16;
+
+public:
+
+  TreeAggregate()
+    : m_NumLeafs(0), m_TotalSize(0), m_ClassCounts()
+  {}
+
+  /**
+   * @brief aggregate of a single leaf
+   **/
+  TreeAggregate(quint64 size, int leafClass)
+    : m_NumLeafs(1), m_TotalSize(size), m_ClassCounts()
+  {
+    m_ClassCounts[leafClass] = 1;
+  }
+
+  /**
+   * @return number of leafs in the subtree
+   **/
+  std::size_t numLeafs() const { return m_NumLeafs; }
+
+  /**
+   * @return sum of the sizes of all leafs in the subtree
+   **/
+  quint64 totalSize() const { return m_TotalSize; }
+
+  /**
+   * @return number of leafs of a class in the subtree
+   **/
+  std::size_t count(int leafClass) const { return m_ClassCounts[leafClass]; }
+
+  /**
+   * @return true if the subtree contains a leaf of the class
+   **/
+  bool contains(int leafClass) const { return m_ClassCounts[leafClass] != 0; }
+
+  /**
+   * @return a mask with bit n set if the subtree contains a leaf of class n
+   **/
+  quint32 classes() const
+  {
+    quint32 result = 0;
+    for (int i = 0; i < NumClasses; ++i) {
+      if (m_ClassCounts[i] != 0) {
+        result |= 1U << i;
+      }
+    }
+    return result;
+  }
+
+  TreeAggregate &operator+=(const TreeAggregate &other)
+  {
+    m_NumLeafs += other.m_NumLeafs;
+    m_TotalSize += other.m_TotalSize;
+    for (int i = 0; i < NumClasses; ++i) {
+      m_ClassCounts[i] += other.m_ClassCounts[i];
+    }
+    return *this;
+  }
+
+  TreeAggregate &operator-=(const TreeAggregate &other)
+  {
+    m_NumLeafs -= other.m_NumLeafs;
+    m_TotalSize -= other.m_TotalSize;
+    for (int i = 0; i < NumClasses; ++i) {
+      m_ClassCounts[i] -= other.m_ClassCounts[i];
+    }
+    return *this;
+  }
+
+private:
+
+  std::size_t m_NumLeafs;
+  quint64 m_TotalSize;
+  // counts rather than a bit per class so removing a leaf can clear the bit
+  quint32 m_ClassCounts[NumClasses];
+
+};
+
+
 /**
  * a tree container using seperate structures for leafs and inner nodes
  * duplicates in NodeData or Leaf-data are not allowed
+ * nodes and the content of the leaf- and node-sets are allocated on the heap by default. A tree
+ * constructed with a TreeArena allocates all its nodes (see createNode) and set entries from
+ * that arena instead
+ * leafs and nodes are kept sorted by Order, a stateless and transparent comparison of LeafT
+ * with LeafT and of NodeData with NodeData or node keys. operator< is used by default,
+ * NaturalOrder sorts numbers in names by their value. Entries Order considers equivalent have
+ * to have the same qHash
  * @note this is currently only used to represent directory structures in the installation
  *       manager
  **/
-template <typename LeafT, typename NodeData>
+template <typename LeafT, typename NodeData, typename Order = std::less<>>
 class MyTree
 {
 
 public:
 
-  typedef MyTree<LeafT, NodeData> Node;
+  typedef MyTree<LeafT, NodeData, Order> Node;
 
 private:
 
+  /**
+   * orders nodes by their data. The comparison is transparent so nodes can be looked up by
+   * anything Order can compare to NodeData
+   */
   struct ByNodeData
   {
-    bool operator()(const Node *lhs, const Node *rhs) const
+    typedef void is_transparent;
+
+    bool operator()(Node *lhs, Node *rhs) const
+    {
+      return Order()(lhs->getData(), rhs->getData());
+    }
+
+    template <typename KeyT>
+    bool operator()(const Node *lhs, const KeyT &rhs) const
+    {
+      return Order()(lhs->getData(), rhs);
+    }
+
+    template <typename KeyT>
+    bool operator()(const KeyT &lhs, const Node *rhs) const
     {
-      return lhs->getData() < rhs->getData();
+      return Order()(lhs, rhs->getData());
     }
   };
 
+  typedef std::set<LeafT, Order, TreeArenaAllocator<LeafT>> LeafSet;
+  typedef std::set<Node*, ByNodeData, TreeArenaAllocator<Node*>> NodeSet;
+
 public:
 
-  typedef typename std::set<LeafT>::iterator leaf_iterator;
-  typedef typename std::set<Node*, ByNodeData>::iterator node_iterator;
+  typedef typename LeafSet::iterator leaf_iterator;
+  typedef typename NodeSet::iterator node_iterator;
 
-  typedef typename std::set<LeafT>::const_iterator const_leaf_iterator;
-  typedef typename std::set<Node*, ByNodeData>::const_iterator const_node_iterator;
+  typedef typename LeafSet::const_iterator const_leaf_iterator;
+  typedef typename NodeSet::const_iterator const_node_iterator;
 
-  typedef typename std::set<Node*, ByNodeData>::const_reverse_iterator const_node_reverse_iterator;
-  typedef typename std::set<LeafT>::const_reverse_iterator const_leaf_reverse_iterator;
+  typedef typename NodeSet::const_reverse_iterator const_node_reverse_iterator;
+  typedef typename LeafSet::const_reverse_iterator const_leaf_reverse_iterator;
 
   typedef typename std::list<std::pair<int, int>> Overwrites;
 
+  /**
+   * number of sub-nodes from which on a node maintains a hash index of its sub-nodes
+   */
+  static const std::size_t NodeIndexThreshold = 64;
+
+  /**
+   * result of a path lookup, see findPath
+   */
+  struct PathEntry
+  {
+    // the node found or the node containing the leaf found. nullptr if the path doesn't exist
+    const Node *node;
+    // the leaf found, nullptr if the path names a node
+    const LeafT *leaf;
+  };
+
 public:
 
   /**
@@ -77,21 +340,75 @@ public:
    **/
   MyTree()
     : m_Parent(nullptr)
+    , m_PathIndexed(false)
+    , m_PathIndexSuspended(false)
+    , m_AggregatesSuspended(false)
+  {}
+
+  /**
+   * @brief constructor for a tree that allocates from an arena
+   *
+   * @param arena the arena to allocate nodes and set entries from. The tree shares ownership
+   *              of the arena
+   **/
+  explicit MyTree(const std::shared_ptr<TreeArena> &arena)
+    : m_Arena(arena)
+    , m_Parent(nullptr)
+    , m_Leafs(Order(), TreeArenaAllocator<LeafT>(arena.get()))
+    , m_Nodes(ByNodeData(), TreeArenaAllocator<Node*>(arena.get()))
+    , m_PathIndexed(false)
+    , m_PathIndexSuspended(false)
+    , m_AggregatesSuspended(false)
   {}
 
   ~MyTree();
 
-  MyTree(const MyTree<LeafT, NodeData> &reference);
+  MyTree(const MyTree<LeafT, NodeData, Order> &reference);
+
+  /**
+   * @brief move constructor. Sub-nodes are taken over without being copied. Both trees share
+   *        the arena afterwards, so reference stays usable
+   */
+  MyTree(MyTree<LeafT, NodeData, Order> &&reference);
+
+  /**
+   * nodes are allocated through TreeArena::allocateNode so that delete works on every node,
+   * independent of whether it was created on the heap or from an arena
+   */
+  static void *operator new(std::size_t size) { return TreeArena::allocateNode(size, nullptr); }
+  static void *operator new(std::size_t size, const std::shared_ptr<TreeArena> &arena) {
+    return TreeArena::allocateNode(size, arena);
+  }
+  static void operator delete(void *ptr) { TreeArena::deallocateNode(ptr); }
+  static void operator delete(void *ptr, const std::shared_ptr<TreeArena>&) {
+    TreeArena::deallocateNode(ptr);
+  }
 
   /**
    * @brief assignment operator
    */
-  MyTree &operator=(const MyTree<LeafT, NodeData> &reference);
+  MyTree &operator=(const MyTree<LeafT, NodeData, Order> &reference);
+
+  /**
+   * @brief move assignment operator
+   */
+  MyTree &operator=(MyTree<LeafT, NodeData, Order> &&reference);
 
   /**
    * @return a deep copy of this tree including all subnodes
    */
-  MyTree<LeafT, NodeData> *copy() const;
+  MyTree<LeafT, NodeData, Order> *copy() const;
+
+  /**
+   * @brief create a new, empty node that allocates from the same arena as this tree
+   * @return the new node. Pass it to addNode or release it with delete
+   */
+  Node *createNode() const { return new (m_Arena) Node(m_Arena); }
+
+  /**
+   * @return the arena this tree allocates from. empty if it allocates from the heap
+   */
+  const std::shared_ptr<TreeArena> &arena() const { return m_Arena; }
 
   /**
    * @brief set the data for this node
@@ -116,23 +433,54 @@ public:
   bool addLeaf(const LeafT &leaf, bool overwrite = true,
                Overwrites *overwrites = nullptr)
   {
-    auto res = m_Leafs.insert(leaf);
-    if (!res.second && overwrite) {
+    return addLeaf(LeafT(leaf), overwrite, overwrites);
+  }
+
+  /**
+   * @brief add a new leaf to this node, moving the leaf data into the tree
+   *
+   * @param leaf the leaf data to attach
+   * @param overwrite if true, the new leaf will overwrite an existing one that
+   *compares as "equal"
+   * @return true if the leaf was added, false if it already exists
+   **/
+  bool addLeaf(LeafT &&leaf, bool overwrite = true,
+               Overwrites *overwrites = nullptr)
+  {
+    auto iter = m_Leafs.lower_bound(leaf);
+    if ((iter == m_Leafs.end()) || Order()(leaf, *iter)) {
+      iter = m_Leafs.emplace_hint(iter, std::move(leaf));
+      if (PathIndex *index = pathIndex()) {
+        updatePathEntry(*index, combinePathHash(pathHash(), qHash(*iter)), this, &*iter, true);
+      }
+      if (m_Aggregate) {
+        adjustAggregates(leafAggregate(*iter), true);
+      }
+      return true;
+    } else if (overwrite) {
       if (overwrites != nullptr) {
         overwrites->push_back(
-            std::make_pair(static_cast<int>(res.first->getIndex()),
+            std::make_pair(static_cast<int>(iter->getIndex()),
                            static_cast<int>(leaf.getIndex())));
       }
-      m_Leafs.erase(res.first);
-      res = m_Leafs.insert(leaf);
+      if (m_Aggregate) {
+        adjustAggregates(leafAggregate(*iter), false);
+        adjustAggregates(leafAggregate(leaf), true);
+      }
+      // reuse the set node of the leaf being replaced
+      auto handle = m_Leafs.extract(iter++);
+      handle.value() = std::move(leaf);
+      m_Leafs.insert(iter, std::move(handle));
+      return true;
     }
-    return res.second;
+    return false;
   }
 
   /**
    * @brief add a new node to the tree
    *
-   * @param node node to add. "this" takes custody of the pointer
+   * @param node node to add. "this" takes custody of the pointer. If the node gets merged
+   *             into an existing one it is deleted afterwards
    * @param merge if true the content of node will merged with an existing node
    * @param overwrites if not null, a list of overwritten nodes will be maintained
    * @param prio priority at which leaves are added. If a high priority leaf
@@ -143,6 +491,56 @@ public:
    **/
   bool addNode(Node *node, bool merge, Overwrites *overwrites = nullptr);
 
+  /**
+   * @brief move the leafs and sub-nodes of another node into this one. Entries are relinked,
+   *        not copied, unless the two nodes allocate from different arenas. If this node is
+   *        empty the whole content is taken over in constant time, apart from updating the
+   *        parent of each direct sub-node
+   *
+   * @param source the node to take the content from. It is left empty, except for sub-nodes
+   *               that already exist here if merge is false. It must not contain this node
+   * @param merge if true sub-nodes existing in both are merged, otherwise they stay in source
+   * @param overwrites if not null, a list of overwritten leafs will be maintained
+   **/
+  void splice(Node &source, bool merge = true, Overwrites *overwrites = nullptr);
+
+  /**
+   * @brief replace the content of this node by the content of a node below it, i.e. to move
+   *        "ModName/Data" to the top of an archive. Everything else below this node is deleted,
+   *        the data of this node itself is kept. Takes constant time plus the cost of
+   *        deleting the replaced entries, see splice
+   *
+   * @param subtree a node anywhere below this one. It is deleted
+   **/
+  void hoist(Node *subtree);
+
+  /**
+   * @brief move a sub-node with all its content to a different parent in the same tree. The
+   *        node is relinked, nothing below it is touched
+   *
+   * @param iter the sub-node to move. The iterator is invalidated if the node is moved
+   * @param newParent the new parent. It must not be inside the moved node
+   * @param merge if true the node is merged into an existing node of the same name under
+   *              newParent, see addNode
+   * @param overwrites if not null, a list of overwritten leafs will be maintained
+   * @return false if merge is false and newParent has such a node already. Nothing is moved
+   *         in that case
+   **/
+  bool reparent(node_iterator iter, Node &newParent, bool merge = true, Overwrites *overwrites = nullptr);
+
+  /**
+   * @return true if node is somewhere below this node
+   **/
+  bool isAncestorOf(const Node *node) const
+  {
+    for (const Node *parent = node->m_Parent; parent != nullptr; parent = parent->m_Parent) {
+      if (parent == this) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   /**
    * @return the number of leafs in the current node
    **/
@@ -216,146 +614,971 @@ public:
   /**
    * @return iterator to node with the specified data
    **/
-  node_iterator nodeFind(const NodeData &data) { Node temp; temp.setData(data); return m_Nodes.find(&temp); }
+  node_iterator nodeFind(const NodeData &data) { return findNode(data); }
 
   /**
    * @return iterator to node with the specified data
    **/
-  const_node_iterator nodeFind(const NodeData &data) const { Node temp; temp.setData(data); return m_Nodes.find(&temp); }
+  const_node_iterator nodeFind(const NodeData &data) const { return findNode(data); }
+
+  /**
+   * @brief find a node by a key other than NodeData (i.e. a FileNameString for a DirectoryTree)
+   *        without constructing a temporary NodeData
+   * @note the key has to be comparable to NodeData with Order and qHash(key) has to
+   *       be consistent with qHash(NodeData)
+   * @return iterator to node matching the key
+   **/
+  template <typename KeyT>
+  typename std::enable_if<!std::is_convertible<KeyT, NodeData>::value, node_iterator>::type
+  nodeFind(const KeyT &key) { return findNode(key); }
+
+  /**
+   * @brief find a node by a key other than NodeData (i.e. a FileNameString for a DirectoryTree)
+   *        without constructing a temporary NodeData
+   * @note the key has to be comparable to NodeData with Order and qHash(key) has to
+   *       be consistent with qHash(NodeData)
+   * @return iterator to node matching the key
+   **/
+  template <typename KeyT>
+  typename std::enable_if<!std::is_convertible<KeyT, NodeData>::value, const_node_iterator>::type
+  nodeFind(const KeyT &key) const { return findNode(key); }
 
   /**
    * @brief erase the leaf at the specfied iterator
    * @return an iterator to the following leaf
    **/
-  leaf_iterator erase(leaf_iterator iter) { return m_Leafs.erase(iter); }
+  leaf_iterator erase(leaf_iterator iter) {
+    if (PathIndex *index = pathIndex()) {
+      updatePathEntry(*index, combinePathHash(pathHash(), qHash(*iter)), this, &*iter, false);
+    }
+    if (m_Aggregate) {
+      adjustAggregates(leafAggregate(*iter), false);
+    }
+    return m_Leafs.erase(iter); }
 
   /**
    * @brief erase the node at the specfied iterator. its content is deleted!
    * @return an iterator to the following node
    **/
-  node_iterator erase(node_iterator iter) { delete *iter; return m_Nodes.erase(iter); }
+  node_iterator erase(node_iterator iter) {
+    unindexNode(iter);
+    unindexPaths(*iter);
+    removeAggregate(*iter);
+    delete *iter;
+    return m_Nodes.erase(iter); }
 
   /**
    * @brief erase the node at the specfied iterator. its content is deleted!
    * @return an iterator to the following node
    **/
   const_node_reverse_iterator erase(const_node_reverse_iterator iter) {
-    delete *iter;
-    const_node_iterator next = m_Nodes.erase((++iter).base());
+    const_node_iterator target = (++iter).base();
+    unindexNode(target);
+    unindexPaths(*target);
+    removeAggregate(*target);
+    delete *target;
+    const_node_iterator next = m_Nodes.erase(target);
     return const_node_reverse_iterator(next); }
 
   /**
-   * @brief remove the node at the specfied iterator but don't delete the content
+   * @brief remove the node at the specfied iterator but don't delete the content. The node
+   *        becomes the root of a tree of its own
    * @return an iterator to the following node
    **/
-  node_iterator detach(node_iterator iter) { return m_Nodes.erase(iter); }
+  node_iterator detach(node_iterator iter) {
+    unindexNode(iter);
+    unindexPaths(*iter);
+    removeAggregate(*iter);
+    (*iter)->m_Parent = nullptr;
+    return m_Nodes.erase(iter); }
 
   /**
    * @return the parent of this node. may be nullptr
    **/
-  const MyTree<LeafT, NodeData> *getParent() const { return m_Parent; }
+  const MyTree<LeafT, NodeData, Order> *getParent() const { return m_Parent; }
 
   /**
    * @return Full pathname of a node or leaf of a node
    **/
   QDLLEXPORT QString getFullPath(LeafT const *leaf = nullptr) const;
 
+  /**
+   * @brief look up a node or leaf by its path below this node, i.e. the components of
+   *        "textures\\armor\\foo.dds", without searching every directory on the way.
+   *        The first lookup builds a hash index of the full paths of all entries on the root of
+   *        the tree. From then on addLeaf, addNode, erase and detach keep it up to date while
+   *        operations that restructure the tree (merging nodes, splice, hoist, reparent,
+   *        assignment) drop it so the next lookup builds it again
+   *
+   * @param begin first path component, i.e. a FileNameString for a DirectoryTree. Like keys
+   *              for nodeFind, components have to be comparable with Order to NodeData and to
+   *              LeafT and have to hash the same
+   * @param end one past the last path component. Both have to be bidirectional iterators
+   * @return the entry with that path. If a leaf and a node share the path the leaf is returned
+   * @note as the first lookup modifies the index, call buildPathIndex before looking up paths
+   *       from several threads. While the index is suspended (see suspendPathIndex) lookups
+   *       resolve the path node by node and don't touch the index
+   **/
+  template <typename Iter>
+  PathEntry findPath(Iter begin, Iter end) const;
+
+  /**
+   * @brief build the path index of the tree this node belongs to, see findPath
+   **/
+  void buildPathIndex() const;
+
+  /**
+   * @brief release the path index of the tree this node belongs to, see findPath
+   **/
+  void dropPathIndex() const;
+
+  /**
+   * @return true if the tree this node belongs to currently has a path index
+   **/
+  bool hasPathIndex() const { return m_PathIndexed; }
+
+  /**
+   * @brief drop the path index of the tree this node belongs to and stop findPath from
+   *        building a new one, so that different subtrees can be modified and searched
+   *        concurrently. Until resumePathIndex, findPath resolves paths node by node
+   **/
+  void suspendPathIndex() const;
+
+  /**
+   * @brief let findPath use and build the path index again after suspendPathIndex
+   **/
+  void resumePathIndex() const { root()->m_PathIndexSuspended = false; }
+
+  /**
+   * @brief make every node of the tree this node belongs to maintain the aggregate of its
+   *        subtree. Takes time linear in the size of the tree, from then on addLeaf, addNode,
+   *        erase and the other modifications update the aggregates of the affected nodes
+   *        and their parents
+   **/
+  void enableAggregates();
+
+  /**
+   * @brief stop maintaining aggregates in the tree this node belongs to
+   **/
+  void disableAggregates();
+
+  /**
+   * @brief stop changes inside the sub-nodes of this node from updating the aggregates of this
+   *        node and its parents, so that different sub-nodes can be modified concurrently.
+   *        The aggregates of the sub-nodes themselves stay up to date
+   **/
+  void suspendAggregates() const { m_AggregatesSuspended = true; }
+
+  /**
+   * @brief recompute the aggregate of this node from its content after suspendAggregates and
+   *        pass the difference on to its parents
+   **/
+  void resumeAggregates() const;
+
+  /**
+   * @return true if the nodes of this tree maintain their aggregates
+   **/
+  bool hasAggregates() const { return m_Aggregate != nullptr; }
+
+  /**
+   * @return summary of all leafs in this subtree. Constant time if aggregates are enabled,
+   *         otherwise this walks the subtree
+   **/
+  TreeAggregate aggregate() const;
+
+private:
+
+  typedef std::unordered_multimap<uint, node_iterator> NodeIndex;
+  typedef std::unordered_multimap<quint64, PathEntry> PathIndex;
+
 private:
 
-  const MyTree<LeafT, NodeData> *m_Parent;
+  void clearNodes();
+
+  void adoptNodes();
+
+  void mergeLeafs(Node &source, Overwrites *overwrites);
+
+  void transferNode(Node &source, node_iterator iter);
+
+  template <typename KeyT>
+  node_iterator findNode(const KeyT &key) const;
+
+  void buildNodeIndex();
+  void indexNode(node_iterator iter);
+  void unindexNode(const_node_iterator iter);
+
+  const Node *root() const
+  {
+    const Node *node = this;
+    while (node->m_Parent != nullptr) {
+      node = node->m_Parent;
+    }
+    return node;
+  }
+
+  // the path index of the tree this node belongs to, nullptr if it has none. The flag spares
+  // trees without an index walking up to the root on every change
+  PathIndex *pathIndex() const { return m_PathIndexed ? root()->m_PathIndex.get() : nullptr; }
+
+  /**
+   * hash of a path from the hash of its parent path and the hash of the last component. Mixed
+   * to 64 bits so that paths rarely collide even in trees with millions of entries
+   */
+  static quint64 combinePathHash(quint64 path, uint name)
+  {
+    quint64 result = path * 0x100000001B3ULL + name + 1;
+    result ^= result >> 33;
+    result *= 0xFF51AFD7ED558CCDULL;
+    result ^= result >> 33;
+    return result;
+  }
+
+  quint64 pathHash() const;
+
+  static void updatePathEntry(PathIndex &index, quint64 hash, const Node *node, const LeafT *leaf, bool add);
+  static void updatePathIndex(PathIndex &index, const Node *subtree, quint64 hash, bool add);
+
+  void unindexPaths(const Node *subtree) const
+  {
+    if (PathIndex *index = pathIndex()) {
+      updatePathIndex(*index, subtree, subtree->pathHash(), false);
+    }
+  }
+
+  template <typename Iter>
+  bool matchesPath(const PathEntry &entry, Iter begin, Iter end) const;
+
+  // findPath without the index
+  template <typename Iter>
+  PathEntry walkPath(Iter begin, Iter end) const;
+
+  // add to or subtract from the aggregates of this node and its parents, up to a node that
+  // suspended its aggregates
+  void adjustAggregates(const TreeAggregate &delta, bool add) const
+  {
+    for (const Node *node = this; (node != nullptr) && !node->m_AggregatesSuspended; node = node->m_Parent) {
+      if (add) {
+        *node->m_Aggregate += delta;
+      } else {
+        *node->m_Aggregate -= delta;
+      }
+    }
+  }
+
+  void removeAggregate(const Node *child) const
+  {
+    if (m_Aggregate) {
+      adjustAggregates(*child->m_Aggregate, false);
+    }
+  }
+
+  static void setSubtreeAggregates(Node *subtree, bool enable);
+  void syncAggregates();
+  // sum up the aggregate of this node from its leafs and sub-nodes and update the parents
+  void recomputeAggregate() const;
+
+private:
+
+  // declared first so the arena outlives the sets allocated from it
+  std::shared_ptr<TreeArena> m_Arena;
+
+  const MyTree<LeafT, NodeData, Order> *m_Parent;
   NodeData m_Data;
 
-  std::set<LeafT> m_Leafs;
-  std::set<Node*, ByNodeData> m_Nodes;
+  LeafSet m_Leafs;
+  NodeSet m_Nodes;
+
+  // hash index into m_Nodes, only maintained for nodes with many sub-nodes
+  std::unique_ptr<NodeIndex> m_NodeIndex;
+
+  // full path index of the whole tree, only used on the root. Built by the first findPath
+  mutable std::unique_ptr<PathIndex> m_PathIndex;
+  // set on every node of a tree that has a path index
+  mutable bool m_PathIndexed;
+  // see suspendPathIndex, only used on the root
+  mutable bool m_PathIndexSuspended;
+
+  // summary of this subtree, either maintained on all nodes of a tree or on none
+  std::unique_ptr<TreeAggregate> m_Aggregate;
+  // see suspendAggregates
+  mutable bool m_AggregatesSuspended;
 
 };
 
 
-template <typename LeafT, typename NodeData>
-MyTree<LeafT, NodeData>::~MyTree()
+template <typename LeafT, typename NodeData, typename Order>
+MyTree<LeafT, NodeData, Order>::~MyTree()
 {
-  for (typename std::set<Node*, ByNodeData>::iterator iter = m_Nodes.begin(); iter != m_Nodes.end(); ++iter) {
-    delete *iter;
-  }
+  clearNodes();
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::clearNodes()
+{
+  // tear down the subtree iteratively. Every node is emptied before it gets deleted so
+  // its own destructor doesn't recurse
+  std::vector<Node*> pending(m_Nodes.begin(), m_Nodes.end());
   m_Nodes.clear();
+  m_NodeIndex.reset();
+  while (!pending.empty()) {
+    Node *node = pending.back();
+    pending.pop_back();
+    pending.insert(pending.end(), node->m_Nodes.begin(), node->m_Nodes.end());
+    node->m_Nodes.clear();
+    node->m_NodeIndex.reset();
+    delete node;
+  }
 }
 
 
-template <typename LeafT, typename NodeData>
-MyTree<LeafT, NodeData>::MyTree(const MyTree<LeafT, NodeData> &reference)
-  : m_Data(reference.m_Data), m_Leafs(reference.m_Leafs)
+template <typename LeafT, typename NodeData, typename Order>
+MyTree<LeafT, NodeData, Order>::MyTree(const MyTree<LeafT, NodeData, Order> &reference)
+  : m_Arena(reference.m_Arena)
+  , m_Parent(nullptr)
+  , m_Data(reference.m_Data)
+  , m_Leafs(reference.m_Leafs)
+  , m_Nodes(ByNodeData(), TreeArenaAllocator<Node*>(reference.m_Arena.get()))
+  , m_PathIndexed(false)
+  , m_PathIndexSuspended(false)
+  , m_AggregatesSuspended(false)
 {
   for (auto iter = reference.m_Nodes.begin(); iter != reference.m_Nodes.end(); ++iter) {
-    auto temp = iter->copy();
-    temp->m_Parent(this);
-    addNode(temp, false);
+    addNode((*iter)->copy(), false);
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+MyTree<LeafT, NodeData, Order>::MyTree(MyTree<LeafT, NodeData, Order> &&reference)
+  // the arena is shared, not moved: the sets of reference keep allocators that refer to it
+  : m_Arena(reference.m_Arena)
+  , m_Parent(nullptr)
+  , m_Data(std::move(reference.m_Data))
+  , m_Leafs(std::move(reference.m_Leafs))
+  , m_Nodes(std::move(reference.m_Nodes))
+  , m_NodeIndex(std::move(reference.m_NodeIndex))
+  , m_PathIndexed(false)
+  , m_PathIndexSuspended(false)
+  , m_AggregatesSuspended(false)
+{
+  reference.dropPathIndex();
+  reference.m_Leafs.clear();
+  reference.m_Nodes.clear();
+  adoptNodes();
+  if (reference.m_Aggregate) {
+    // the content moved here, so it is no longer part of the tree of reference
+    m_Aggregate.reset(new TreeAggregate(*reference.m_Aggregate));
+    reference.adjustAggregates(*m_Aggregate, false);
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::adoptNodes()
+{
+  for (Node *node : m_Nodes) {
+    node->m_Parent = this;
   }
 }
 
 
-template <typename LeafT, typename NodeData>
-MyTree<LeafT, NodeData> &MyTree<LeafT, NodeData>::operator=(const MyTree<LeafT, NodeData> &reference)
+template <typename LeafT, typename NodeData, typename Order>
+MyTree<LeafT, NodeData, Order> &MyTree<LeafT, NodeData, Order>::operator=(MyTree<LeafT, NodeData, Order> &&reference)
 {
   if (this != &reference) {
+    dropPathIndex();
+    reference.dropPathIndex();
+    clearNodes();
+    // the sets keep their allocators so this only avoids copies if both trees use the
+    // same arena. Either way the sub-nodes themselves are taken over, not copied
+    m_Data = std::move(reference.m_Data);
+    m_Leafs = std::move(reference.m_Leafs);
+    m_Nodes = std::move(reference.m_Nodes);
+    reference.m_Leafs.clear();
+    reference.m_Nodes.clear();
+    reference.m_NodeIndex.reset();
+    adoptNodes();
+    if (m_Nodes.size() >= NodeIndexThreshold) {
+      buildNodeIndex();
+    }
+    syncAggregates();
+    reference.syncAggregates();
+  }
+  return *this;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+MyTree<LeafT, NodeData, Order> &MyTree<LeafT, NodeData, Order>::operator=(const MyTree<LeafT, NodeData, Order> &reference)
+{
+  if (this != &reference) {
+    dropPathIndex();
     m_Data = reference.m_Data;
     m_Leafs = reference.m_Leafs;
 
-    for (typename std::set<Node*, ByNodeData>::iterator iter = m_Nodes.begin(); iter != m_Nodes.end(); ++iter) {
-      delete *iter;
-    }
-    m_Nodes.clear();
+    clearNodes();
 
     for (auto iter = reference.m_Nodes.begin(); iter != reference.m_Nodes.end(); ++iter) {
-      Node *temp = (*iter)->copy();
-      temp->m_Parent = this;
-      addNode(temp, false);
+      addNode((*iter)->copy(), false);
     }
+    syncAggregates();
   }
   return *this;
 }
 
 
-template <typename LeafT, typename NodeData>
-MyTree<LeafT, NodeData> *MyTree<LeafT, NodeData>::copy() const
+template <typename LeafT, typename NodeData, typename Order>
+MyTree<LeafT, NodeData, Order> *MyTree<LeafT, NodeData, Order>::copy() const
 {
-  MyTree<LeafT, NodeData> *result = new MyTree<LeafT, NodeData>();
+  MyTree<LeafT, NodeData, Order> *result = createNode();
 
   result->m_Data = this->m_Data;
   result->m_Leafs = this->m_Leafs;
+  // addNode sets the parent of the copies to result
   for (auto iter = this->m_Nodes.begin(); iter != this->m_Nodes.end(); ++iter) {
-    Node *temp = (*iter)->copy();
-    temp->m_Parent = this;
-    result->addNode(temp, false);
+    result->addNode((*iter)->copy(), false);
   }
 
   return result;
 }
 
 
-template <typename LeafT, typename NodeData>
-bool MyTree<LeafT, NodeData>::addNode(Node *node, bool merge, Overwrites *overwrites)
+template <typename LeafT, typename NodeData, typename Order>
+bool MyTree<LeafT, NodeData, Order>::addNode(Node *node, bool merge, Overwrites *overwrites)
 {
-  std::pair<typename std::set<Node*, ByNodeData>::iterator, bool> res = m_Nodes.insert(node);
+  std::pair<node_iterator, bool> res = m_Nodes.insert(node);
   if (res.second) {
     // no merge required
     node->m_Parent = this;
+    indexNode(res.first);
+    node->dropPathIndex();
+    if (PathIndex *index = pathIndex()) {
+      updatePathIndex(*index, node, node->pathHash(), true);
+    }
+    setSubtreeAggregates(node, m_Aggregate != nullptr);
+    if (m_Aggregate) {
+      adjustAggregates(*node->m_Aggregate, true);
+    }
     return true;
   } else if (!res.second && merge) {
-    // merge required
+    // merge required. Cheaper to rebuild the path index later than to update it per entry
+    dropPathIndex();
+    node->dropPathIndex();
     for (node_iterator iter = node->nodesBegin(); iter != node->nodesEnd();) {
       Node *subNode = *iter;
       iter = node->detach(iter);
       (*res.first)->addNode(subNode, merge, overwrites);
     }
-    for (leaf_iterator iter = node->leafsBegin(); iter != node->leafsEnd(); ++iter) {
-      (*res.first)->addLeaf(*iter, true, overwrites);
-    }
+    (*res.first)->mergeLeafs(*node, overwrites);
+    // we have custody of the merged node. Releasing it matters for arena-allocated nodes
+    // since they keep their arena alive
+    delete node;
     return true;
   }
   // node exists and merge was disabled
   return false;
 }
 
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::splice(Node &source, bool merge, Overwrites *overwrites)
+{
+  if (&source == this) {
+    return;
+  }
+  Q_ASSERT(!source.isAncestorOf(this));
+  dropPathIndex();
+  source.dropPathIndex();
+
+  if (m_Leafs.empty() && (m_Leafs.get_allocator() == source.m_Leafs.get_allocator())) {
+    m_Leafs.swap(source.m_Leafs);
+  } else {
+    mergeLeafs(source, overwrites);
+  }
+
+  if (m_Nodes.empty() && (m_Nodes.get_allocator() == source.m_Nodes.get_allocator())) {
+    // the index refers to set entries, so it moves along with them
+    m_Nodes.swap(source.m_Nodes);
+    m_NodeIndex.swap(source.m_NodeIndex);
+    adoptNodes();
+  } else {
+    for (node_iterator iter = source.m_Nodes.begin(); iter != source.m_Nodes.end();) {
+      node_iterator existing = findNode((*iter)->getData());
+      if (existing == m_Nodes.end()) {
+        transferNode(source, iter++);
+      } else if (merge) {
+        Node *node = *iter;
+        iter = source.detach(iter);
+        addNode(node, true, overwrites);
+      } else {
+        ++iter;
+      }
+    }
+  }
+
+  syncAggregates();
+  source.syncAggregates();
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::hoist(Node *subtree)
+{
+  Q_ASSERT(isAncestorOf(subtree));
+  dropPathIndex();
+  Node *parent = const_cast<Node*>(subtree->m_Parent);
+  parent->detach(parent->findNode(subtree->getData()));
+
+  m_Leafs.clear();
+  clearNodes();
+  splice(*subtree, false);
+  delete subtree;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+bool MyTree<LeafT, NodeData, Order>::reparent(node_iterator iter, Node &newParent, bool merge, Overwrites *overwrites)
+{
+  Node *node = *iter;
+  Q_ASSERT((node != &newParent) && !node->isAncestorOf(&newParent));
+  if (&newParent == this) {
+    return true;
+  }
+  dropPathIndex();
+  newParent.dropPathIndex();
+  node_iterator existing = newParent.findNode(node->getData());
+  if (existing == newParent.m_Nodes.end()) {
+    newParent.transferNode(*this, iter);
+    return true;
+  } else if (merge) {
+    detach(iter);
+    newParent.addNode(node, true, overwrites);
+    return true;
+  }
+  return false;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::transferNode(Node &source, node_iterator iter)
+{
+  // moves a sub-node of source that doesn't exist here yet. The set entry itself is moved
+  // over if both sets share an allocator
+  Node *node = *iter;
+  source.unindexNode(iter);
+  source.removeAggregate(node);
+  node_iterator position;
+  if (m_Nodes.get_allocator() == source.m_Nodes.get_allocator()) {
+    position = m_Nodes.insert(source.m_Nodes.extract(iter)).position;
+  } else {
+    source.m_Nodes.erase(iter);
+    position = m_Nodes.insert(node).first;
+  }
+  node->m_Parent = this;
+  indexNode(position);
+  setSubtreeAggregates(node, m_Aggregate != nullptr);
+  if (m_Aggregate) {
+    adjustAggregates(*node->m_Aggregate, true);
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::mergeLeafs(Node &source, Overwrites *overwrites)
+{
+  if (m_Leafs.get_allocator() != source.m_Leafs.get_allocator()) {
+    // set nodes can only be transferred between sets sharing an allocator. addLeaf updates
+    // the aggregates
+    for (leaf_iterator iter = source.m_Leafs.begin(); iter != source.m_Leafs.end(); ++iter) {
+      addLeaf(*iter, true, overwrites);
+    }
+    source.m_Leafs.clear();
+    return;
+  }
+
+  if (m_Aggregate) {
+    // everything in source ends up here, overwritten leafs are subtracted below
+    TreeAggregate added;
+    for (const LeafT &leaf : source.m_Leafs) {
+      added += leafAggregate(leaf);
+    }
+    adjustAggregates(added, true);
+  }
+
+  // splice all leafs that don't exist here yet, what remains in source are the conflicts
+  m_Leafs.merge(source.m_Leafs);
+  while (!source.m_Leafs.empty()) {
+    auto handle = source.m_Leafs.extract(source.m_Leafs.begin());
+    leaf_iterator existing = m_Leafs.find(handle.value());
+    if (overwrites != nullptr) {
+      overwrites->push_back(
+          std::make_pair(static_cast<int>(existing->getIndex()),
+                         static_cast<int>(handle.value().getIndex())));
+    }
+    if (m_Aggregate) {
+      adjustAggregates(leafAggregate(*existing), false);
+    }
+    m_Leafs.insert(m_Leafs.erase(existing), std::move(handle));
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+template <typename KeyT>
+typename MyTree<LeafT, NodeData, Order>::node_iterator MyTree<LeafT, NodeData, Order>::findNode(const KeyT &key) const
+{
+  static_assert(!std::is_pointer<typename std::decay<KeyT>::type>::value,
+                "pointers can't be used as node keys, wrap them in a key type");
+  NodeSet &nodes = const_cast<NodeSet&>(m_Nodes);
+  if (m_NodeIndex) {
+    ByNodeData compare;
+    auto range = m_NodeIndex->equal_range(qHash(key));
+    for (auto iter = range.first; iter != range.second; ++iter) {
+      const Node *candidate = *iter->second;
+      if (!compare(candidate, key) && !compare(key, candidate)) {
+        return iter->second;
+      }
+    }
+    return nodes.end();
+  } else {
+    return nodes.find(key);
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::indexNode(node_iterator iter)
+{
+  if (m_NodeIndex) {
+    m_NodeIndex->insert(std::make_pair(qHash((*iter)->getData()), iter));
+  } else if (m_Nodes.size() >= NodeIndexThreshold) {
+    // the index is built eagerly so that lookups never modify the tree
+    buildNodeIndex();
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::buildNodeIndex()
+{
+  m_NodeIndex.reset(new NodeIndex(m_Nodes.size() * 2));
+  for (node_iterator iter = m_Nodes.begin(); iter != m_Nodes.end(); ++iter) {
+    m_NodeIndex->insert(std::make_pair(qHash((*iter)->getData()), iter));
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::unindexNode(const_node_iterator iter)
+{
+  if (m_NodeIndex) {
+    auto range = m_NodeIndex->equal_range(qHash((*iter)->getData()));
+    for (auto indexIter = range.first; indexIter != range.second; ++indexIter) {
+      if (indexIter->second == iter) {
+        m_NodeIndex->erase(indexIter);
+        break;
+      }
+    }
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+template <typename Iter>
+typename MyTree<LeafT, NodeData, Order>::PathEntry MyTree<LeafT, NodeData, Order>::findPath(Iter begin, Iter end) const
+{
+  PathEntry result = { nullptr, nullptr };
+  if (begin == end) {
+    result.node = this;
+    return result;
+  }
+
+  const Node *top = root();
+  if (top->m_PathIndexSuspended) {
+    return walkPath(begin, end);
+  }
+  if (!top->m_PathIndex) {
+    buildPathIndex();
+  }
+
+  quint64 hash = pathHash();
+  for (Iter iter = begin; iter != end; ++iter) {
+    hash = combinePathHash(hash, qHash(*iter));
+  }
+  // different paths may share a hash, the candidates are verified by walking up from them
+  auto range = top->m_PathIndex->equal_range(hash);
+  for (auto iter = range.first; iter != range.second; ++iter) {
+    if (matchesPath(iter->second, begin, end)) {
+      result = iter->second;
+      if (result.leaf != nullptr) {
+        break;
+      }
+    }
+  }
+  return result;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+template <typename Iter>
+bool MyTree<LeafT, NodeData, Order>::matchesPath(const PathEntry &entry, Iter begin, Iter end) const
+{
+  // compare the components from the back while walking up from the entry to this node
+  const Node *node = entry.node;
+  if (entry.leaf != nullptr) {
+    --end;
+    if (Order()(*entry.leaf, *end) || Order()(*end, *entry.leaf)) {
+      return false;
+    }
+  }
+  while (end != begin) {
+    if ((node == this) || (node == nullptr)) {
+      return false;
+    }
+    --end;
+    if (Order()(node->m_Data, *end) || Order()(*end, node->m_Data)) {
+      return false;
+    }
+    node = node->m_Parent;
+  }
+  return node == this;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+template <typename Iter>
+typename MyTree<LeafT, NodeData, Order>::PathEntry MyTree<LeafT, NodeData, Order>::walkPath(Iter begin, Iter end) const
+{
+  PathEntry result = { nullptr, nullptr };
+  const Node *node = this;
+  Iter last = end;
+  --last;
+  for (Iter iter = begin; iter != last; ++iter) {
+    auto child = node->findNode(*iter);
+    if (child == node->m_Nodes.end()) {
+      return result;
+    }
+    node = *child;
+  }
+  // same as with the index, a leaf wins over a node of the same name
+  auto leaf = node->m_Leafs.find(*last);
+  if (leaf != node->m_Leafs.end()) {
+    result.node = node;
+    result.leaf = &*leaf;
+  } else {
+    auto child = node->findNode(*last);
+    if (child != node->m_Nodes.end()) {
+      result.node = *child;
+    }
+  }
+  return result;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::buildPathIndex() const
+{
+  const Node *top = root();
+  top->m_PathIndex.reset(new PathIndex());
+  top->m_PathIndexed = true;
+  for (auto iter = top->m_Leafs.begin(); iter != top->m_Leafs.end(); ++iter) {
+    updatePathEntry(*top->m_PathIndex, combinePathHash(0, qHash(*iter)), top, &*iter, true);
+  }
+  for (const Node *node : top->m_Nodes) {
+    updatePathIndex(*top->m_PathIndex, node, combinePathHash(0, qHash(node->m_Data)), true);
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::enableAggregates()
+{
+  setSubtreeAggregates(const_cast<Node*>(root()), true);
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::disableAggregates()
+{
+  setSubtreeAggregates(const_cast<Node*>(root()), false);
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+TreeAggregate MyTree<LeafT, NodeData, Order>::aggregate() const
+{
+  if (m_Aggregate) {
+    return *m_Aggregate;
+  }
+  TreeAggregate result;
+  std::vector<const Node*> pending(1, this);
+  while (!pending.empty()) {
+    const Node *node = pending.back();
+    pending.pop_back();
+    for (const LeafT &leaf : node->m_Leafs) {
+      result += leafAggregate(leaf);
+    }
+    pending.insert(pending.end(), node->m_Nodes.begin(), node->m_Nodes.end());
+  }
+  return result;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::setSubtreeAggregates(Node *subtree, bool enable)
+{
+  // a subtree is always in one state, so there is nothing to do if its root is
+  if ((subtree->m_Aggregate != nullptr) == enable) {
+    return;
+  }
+  std::vector<Node*> nodes(1, subtree);
+  for (std::size_t i = 0; i < nodes.size(); ++i) {
+    nodes.insert(nodes.end(), nodes[i]->m_Nodes.begin(), nodes[i]->m_Nodes.end());
+  }
+  if (!enable) {
+    for (Node *node : nodes) {
+      node->m_Aggregate.reset();
+    }
+    return;
+  }
+  // in reverse so that sub-nodes are summed up before their parents
+  for (auto iter = nodes.rbegin(); iter != nodes.rend(); ++iter) {
+    Node *node = *iter;
+    node->m_Aggregate.reset(new TreeAggregate());
+    for (const LeafT &leaf : node->m_Leafs) {
+      *node->m_Aggregate += leafAggregate(leaf);
+    }
+    for (const Node *child : node->m_Nodes) {
+      *node->m_Aggregate += *child->m_Aggregate;
+    }
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::resumeAggregates() const
+{
+  m_AggregatesSuspended = false;
+  recomputeAggregate();
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::recomputeAggregate() const
+{
+  if (!m_Aggregate) {
+    return;
+  }
+  TreeAggregate current;
+  for (const LeafT &leaf : m_Leafs) {
+    current += leafAggregate(leaf);
+  }
+  for (const Node *node : m_Nodes) {
+    current += *node->m_Aggregate;
+  }
+  TreeAggregate previous = *m_Aggregate;
+  adjustAggregates(previous, false);
+  adjustAggregates(current, true);
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::syncAggregates()
+{
+  // after sub-nodes were taken over wholesale: bring them into the state of this tree and
+  // recompute the aggregate of this node from its content
+  for (Node *node : m_Nodes) {
+    setSubtreeAggregates(node, m_Aggregate != nullptr);
+  }
+  recomputeAggregate();
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::suspendPathIndex() const
+{
+  dropPathIndex();
+  root()->m_PathIndexSuspended = true;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::dropPathIndex() const
+{
+  if (!m_PathIndexed) {
+    return;
+  }
+  const Node *top = root();
+  top->m_PathIndex.reset();
+  std::vector<const Node*> pending(1, top);
+  while (!pending.empty()) {
+    const Node *node = pending.back();
+    pending.pop_back();
+    node->m_PathIndexed = false;
+    pending.insert(pending.end(), node->m_Nodes.begin(), node->m_Nodes.end());
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+quint64 MyTree<LeafT, NodeData, Order>::pathHash() const
+{
+  // the root has no path of its own, so it isn't part of the index. Iterative since trees
+  // can be deep
+  std::vector<const Node*> nodes;
+  for (const Node *node = this; node->m_Parent != nullptr; node = node->m_Parent) {
+    nodes.push_back(node);
+  }
+  quint64 result = 0;
+  for (auto iter = nodes.rbegin(); iter != nodes.rend(); ++iter) {
+    result = combinePathHash(result, qHash((*iter)->m_Data));
+  }
+  return result;
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::updatePathEntry(PathIndex &index, quint64 hash, const Node *node,
+                                                     const LeafT *leaf, bool add)
+{
+  if (add) {
+    PathEntry entry = { node, leaf };
+    index.insert(std::make_pair(hash, entry));
+    return;
+  }
+  auto range = index.equal_range(hash);
+  for (auto iter = range.first; iter != range.second; ++iter) {
+    if ((iter->second.node == node) && (iter->second.leaf == leaf)) {
+      index.erase(iter);
+      break;
+    }
+  }
+}
+
+
+template <typename LeafT, typename NodeData, typename Order>
+void MyTree<LeafT, NodeData, Order>::updatePathIndex(PathIndex &index, const Node *subtree, quint64 hash,
+                                                     bool add)
+{
+  // adds or removes the subtree and everything below it. iterative since trees can be deep
+  std::vector<std::pair<const Node*, quint64>> pending(1, std::make_pair(subtree, hash));
+  while (!pending.empty()) {
+    const Node *node = pending.back().first;
+    quint64 nodeHash = pending.back().second;
+    pending.pop_back();
+    node->m_PathIndexed = add;
+    updatePathEntry(index, nodeHash, node, nullptr, add);
+    for (auto iter = node->m_Leafs.begin(); iter != node->m_Leafs.end(); ++iter) {
+      updatePathEntry(index, combinePathHash(nodeHash, qHash(*iter)), node, &*iter, add);
+    }
+    for (const Node *child : node->m_Nodes) {
+      pending.push_back(std::make_pair(child, combinePathHash(nodeHash, qHash(child->m_Data))));
+    }
+  }
+}
+
 } // namespace MOBase
 
 #endif // MYTREE_H
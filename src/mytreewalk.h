@@ -0,0 +1,306 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef MYTREEWALK_H
+#define MYTREEWALK_H
+
+#include "mytree.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace MOBase {
+
+/**
+ * Walkers for MyTree that keep their state on the heap instead of recursing, so the depth of
+ * a tree doesn't affect stack usage.
+ * TreeT is a MyTree instantiation, const-qualified for read-only walks.
+ * None of the walkers allow the tree to be modified while they're in use.
+ */
+
+
+/**
+ * returned by visitors passed to walkTree
+ */
+enum class TreeWalk {
+  // visit the children of the current node
+  Continue,
+  // don't visit anything below the current node
+  SkipChildren,
+  // end the walk
+  Stop
+};
+
+
+/**
+ * visits all nodes of a tree depth-first, each node before its children, children in tree
+ * order. The node the iterator is created on is visited first, at depth 0.
+ * Usage:
+ *   for (TreeDepthFirstIterator<const DirectoryTree> iter(tree); iter.next();) {
+ *     use(iter.node());
+ *   }
+ */
+template <typename TreeT>
+class TreeDepthFirstIterator {
+public:
+  explicit TreeDepthFirstIterator(TreeT &tree)
+    : m_Current(nullptr), m_Depth(0), m_SkipChildren(false)
+  {
+    Entry entry = { &tree, 0 };
+    m_Stack.push_back(entry);
+  }
+
+  /**
+   * @brief advance to the next node. This has to be called once before accessing the first node
+   * @return false if there are no more nodes
+   */
+  bool next()
+  {
+    if ((m_Current != nullptr) && !m_SkipChildren) {
+      // pushed in reverse so the first child ends up on top
+      for (auto iter = m_Current->nodesRBegin(); iter != m_Current->nodesREnd(); ++iter) {
+        Entry entry = { *iter, m_Depth + 1 };
+        m_Stack.push_back(entry);
+      }
+    }
+    m_SkipChildren = false;
+    if (m_Stack.empty()) {
+      m_Current = nullptr;
+      return false;
+    }
+    m_Current = m_Stack.back().node;
+    m_Depth = m_Stack.back().depth;
+    m_Stack.pop_back();
+    return true;
+  }
+
+  /**
+   * @brief don't descend into the current node
+   */
+  void skipChildren() { m_SkipChildren = true; }
+
+  /**
+   * @return the current node
+   */
+  TreeT &node() const { return *m_Current; }
+
+  /**
+   * @return distance of the current node from the node the walk started on
+   */
+  int depth() const { return m_Depth; }
+
+private:
+  struct Entry {
+    TreeT *node;
+    int depth;
+  };
+
+  std::vector<Entry> m_Stack;
+  TreeT *m_Current;
+  int m_Depth;
+  bool m_SkipChildren;
+};
+
+
+/**
+ * visits all nodes of a tree level by level, children in tree order. The node the iterator is
+ * created on is visited first, at depth 0.
+ * Usage is the same as with TreeDepthFirstIterator
+ */
+template <typename TreeT>
+class TreeBreadthFirstIterator {
+public:
+  explicit TreeBreadthFirstIterator(TreeT &tree)
+    : m_Current(nullptr), m_Depth(0), m_SkipChildren(false)
+  {
+    Entry entry = { &tree, 0 };
+    m_Queue.push_back(entry);
+  }
+
+  /**
+   * @brief advance to the next node. This has to be called once before accessing the first node
+   * @return false if there are no more nodes
+   */
+  bool next()
+  {
+    if ((m_Current != nullptr) && !m_SkipChildren) {
+      for (auto iter = m_Current->nodesBegin(); iter != m_Current->nodesEnd(); ++iter) {
+        Entry entry = { *iter, m_Depth + 1 };
+        m_Queue.push_back(entry);
+      }
+    }
+    m_SkipChildren = false;
+    if (m_Queue.empty()) {
+      m_Current = nullptr;
+      return false;
+    }
+    m_Current = m_Queue.front().node;
+    m_Depth = m_Queue.front().depth;
+    m_Queue.pop_front();
+    return true;
+  }
+
+  /**
+   * @brief don't visit the children of the current node
+   */
+  void skipChildren() { m_SkipChildren = true; }
+
+  /**
+   * @return the current node
+   */
+  TreeT &node() const { return *m_Current; }
+
+  /**
+   * @return distance of the current node from the node the walk started on
+   */
+  int depth() const { return m_Depth; }
+
+private:
+  struct Entry {
+    TreeT *node;
+    int depth;
+  };
+
+  std::deque<Entry> m_Queue;
+  TreeT *m_Current;
+  int m_Depth;
+  bool m_SkipChildren;
+};
+
+
+/**
+ * @brief visit the nodes of a tree depth-first
+ *
+ * @param tree the tree to walk
+ * @param visitor callable as TreeWalk visitor(TreeT &node, int depth). The return value
+ *                decides whether the children of node are visited and whether the walk
+ *                continues at all
+ * @return false if the visitor stopped the walk
+ */
+template <typename TreeT, typename VisitorT>
+bool walkTree(TreeT &tree, VisitorT visitor)
+{
+  for (TreeDepthFirstIterator<TreeT> iter(tree); iter.next();) {
+    TreeWalk result = visitor(iter.node(), iter.depth());
+    if (result == TreeWalk::Stop) {
+      return false;
+    } else if (result == TreeWalk::SkipChildren) {
+      iter.skipChildren();
+    }
+  }
+  return true;
+}
+
+
+/**
+ * @brief call a function for every direct sub-node of a tree on a number of worker threads.
+ *        Subtrees are handed out one at a time so the threads stay busy even if the subtrees
+ *        differ in size. Returns once all calls are done.
+ *
+ * @param tree the tree whose sub-nodes are processed
+ * @param function callable as function(TreeT &subtree). This is called concurrently for
+ *                 different subtrees, it may only modify the subtree it's given and must not
+ *                 allocate from the arena of the tree since arenas aren't thread safe
+ * @param numThreads maximum number of threads to use. 0 uses one thread per core
+ * @note while the threads run, changes don't update the aggregates of tree and its parents
+ *       (see MyTree::suspendAggregates). They are brought up to date before this returns
+ * @note the path index of the whole tree is a single hash map that can't be updated from
+ *       several threads. It is suspended while the threads run (see MyTree::suspendPathIndex)
+ *       and, if there was one, rebuilt before this returns. function may still look up paths
+ *       with findPath or resolvePath, they are resolved node by node in the meantime
+ * @note if function throws, the remaining subtrees are skipped and the first exception is
+ *       rethrown on the calling thread
+ */
+template <typename TreeT, typename FunctionT>
+void parallelForEachSubtree(TreeT &tree, FunctionT function, unsigned int numThreads = 0)
+{
+  std::vector<TreeT*> subtrees(tree.nodesBegin(), tree.nodesEnd());
+
+  if (numThreads == 0) {
+    numThreads = std::max(1U, std::thread::hardware_concurrency());
+  }
+  numThreads = std::min<unsigned int>(numThreads, static_cast<unsigned int>(subtrees.size()));
+
+  if (numThreads <= 1) {
+    for (TreeT *subtree : subtrees) {
+      function(*subtree);
+    }
+    return;
+  }
+
+  // the aggregates of tree and its parents and the path index are shared by all subtrees,
+  // so they are brought up to date once after all subtrees are done, even if function throws
+  struct TreeStateGuard {
+    TreeT &tree;
+    bool indexed;
+    ~TreeStateGuard()
+    {
+      tree.resumeAggregates();
+      tree.resumePathIndex();
+      if (indexed) {
+        tree.buildPathIndex();
+      }
+    }
+  } treeStateGuard = { tree, tree.hasPathIndex() };
+  tree.suspendPathIndex();
+  tree.suspendAggregates();
+
+  std::atomic<std::size_t> nextSubtree(0);
+  std::exception_ptr error;
+  std::mutex errorMutex;
+
+  auto worker = [&] () {
+    for (std::size_t i = nextSubtree++; i < subtrees.size(); i = nextSubtree++) {
+      try {
+        function(*subtrees[i]);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        nextSubtree = subtrees.size();
+      }
+    }
+  };
+
+  // the calling thread does its share of the work too
+  std::vector<std::thread> threads;
+  for (unsigned int i = 1; i < numThreads; ++i) {
+    threads.push_back(std::thread(worker));
+  }
+  worker();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+} // namespace MOBase
+
+#endif // MYTREEWALK_H
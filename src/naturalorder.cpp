@@ -0,0 +1,146 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "naturalorder.h"
+
+namespace MOBase {
+
+
+namespace {
+
+inline bool isDigit(ushort value)
+{
+  return (value >= '0') && (value <= '9');
+}
+
+
+/**
+ * reads the units of a string that is case folded already
+ */
+struct FoldedReader
+{
+  uint operator()(const ushort *data, int, int &pos) const
+  {
+    return data[pos++];
+  }
+};
+
+
+/**
+ * reads a string and folds it on the fly. A character is returned as its first folded unit
+ * followed by the second one if it needs a surrogate pair, so the values compare the same way
+ * the units of the folded string would and names are ordered exactly like FoldedReader orders
+ * their keys
+ */
+struct FoldingReader
+{
+  uint operator()(const ushort *data, int length, int &pos) const
+  {
+    uint value = data[pos++];
+    if (value < 0x80) {
+      return (((value >= 'A') && (value <= 'Z')) ? value + 0x20 : value) << 16;
+    }
+    if (QChar::isHighSurrogate(value) && (pos < length) && QChar::isLowSurrogate(data[pos])) {
+      uint folded = QChar::toCaseFolded(QChar::surrogateToUcs4(static_cast<ushort>(value), data[pos++]));
+      return (static_cast<uint>(QChar::highSurrogate(folded)) << 16) | QChar::lowSurrogate(folded);
+    }
+    return QChar::toCaseFolded(value) << 16;
+  }
+};
+
+
+template <typename Reader>
+int compareNatural(const ushort *lhs, int lhsLength, const ushort *rhs, int rhsLength, Reader read)
+{
+  // decides between names that only differ in leading zeros
+  int tieBreak = 0;
+  int lhsPos = 0;
+  int rhsPos = 0;
+  while ((lhsPos < lhsLength) && (rhsPos < rhsLength)) {
+    if (isDigit(lhs[lhsPos]) && isDigit(rhs[rhsPos])) {
+      int lhsZeros = 0;
+      while ((lhsPos < lhsLength) && (lhs[lhsPos] == '0')) {
+        ++lhsPos;
+        ++lhsZeros;
+      }
+      int rhsZeros = 0;
+      while ((rhsPos < rhsLength) && (rhs[rhsPos] == '0')) {
+        ++rhsPos;
+        ++rhsZeros;
+      }
+      // without leading zeros the longer number is the larger one. Numbers of the same length
+      // are ordered by their first differing digit
+      int firstDifference = 0;
+      for (;;) {
+        bool lhsDigit = (lhsPos < lhsLength) && isDigit(lhs[lhsPos]);
+        bool rhsDigit = (rhsPos < rhsLength) && isDigit(rhs[rhsPos]);
+        if (!lhsDigit || !rhsDigit) {
+          if (lhsDigit != rhsDigit) {
+            return lhsDigit ? 1 : -1;
+          }
+          break;
+        }
+        if ((firstDifference == 0) && (lhs[lhsPos] != rhs[rhsPos])) {
+          firstDifference = (lhs[lhsPos] < rhs[rhsPos]) ? -1 : 1;
+        }
+        ++lhsPos;
+        ++rhsPos;
+      }
+      if (firstDifference != 0) {
+        return firstDifference;
+      }
+      if ((tieBreak == 0) && (lhsZeros != rhsZeros)) {
+        tieBreak = (lhsZeros < rhsZeros) ? -1 : 1;
+      }
+      continue;
+    }
+
+    uint lhsValue = read(lhs, lhsLength, lhsPos);
+    uint rhsValue = read(rhs, rhsLength, rhsPos);
+    if (lhsValue != rhsValue) {
+      return (lhsValue < rhsValue) ? -1 : 1;
+    }
+  }
+
+  if (lhsPos < lhsLength) {
+    return 1;
+  } else if (rhsPos < rhsLength) {
+    return -1;
+  }
+  return tieBreak;
+}
+
+} // namespace
+
+
+int naturalCompare(const QString &lhs, const QString &rhs)
+{
+  return compareNatural(lhs.utf16(), lhs.size(), rhs.utf16(), rhs.size(), FoldingReader());
+}
+
+
+int naturalCompare(const FileNameString &lhs, const FileNameString &rhs)
+{
+  return compareNatural(reinterpret_cast<const ushort*>(lhs.foldedData()), lhs.size(),
+                        reinterpret_cast<const ushort*>(rhs.foldedData()), rhs.size(),
+                        FoldedReader());
+}
+
+} // namespace MOBase
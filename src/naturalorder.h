@@ -0,0 +1,80 @@
+/*
+Mod Organizer shared UI functionality
+
+Copyright (C) 2012 Sebastian Herbord. All rights reserved.
+
+This library is free software; you can redistribute it and/or
+modify it under the terms of the GNU Lesser General Public
+License as published by the Free Software Foundation; either
+version 3 of the License, or (at your option) any later version.
+
+This library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public
+License along with this library; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef NATURALORDER_H
+#define NATURALORDER_H
+
+#include "dllimport.h"
+#include "filenamestring.h"
+
+#include <QString>
+
+namespace MOBase {
+
+/**
+ * @brief compare two names in natural order: case-insensitive, with runs of digits compared by
+ *        their value, so "part2" comes before "part10". Leading zeros only decide between names
+ *        that are otherwise equal ("part2" before "part02"), which means names are only equal if
+ *        they are equal ignoring case.
+ *        The names are compared in a single pass without allocating or consulting the locale
+ * @return a negative number, zero or a positive number like QString::compare
+ */
+QDLLEXPORT int naturalCompare(const QString &lhs, const QString &rhs);
+
+/**
+ * @brief same as naturalCompare for QStrings, but uses the case folded keys the names keep
+ *        anyway
+ */
+QDLLEXPORT int naturalCompare(const FileNameString &lhs, const FileNameString &rhs);
+
+/**
+ * @return the name an object is sorted by in natural order. Overload this next to a type to
+ *         make NaturalOrder support it
+ */
+inline const FileNameString &naturalKey(const FileNameString &name)
+{
+  return name;
+}
+
+/**
+ * a "less than" in natural order, for sorting lists of names
+ *   std::sort(names.begin(), names.end(), NaturalOrder());
+ * and as the Order of a MyTree. Types other than QString are compared by what naturalKey()
+ * returns for them
+ */
+struct NaturalOrder
+{
+  typedef void is_transparent;
+
+  bool operator()(const QString &lhs, const QString &rhs) const
+  {
+    return naturalCompare(lhs, rhs) < 0;
+  }
+
+  template <typename LhsT, typename RhsT>
+  bool operator()(const LhsT &lhs, const RhsT &rhs) const
+  {
+    return naturalCompare(naturalKey(lhs), naturalKey(rhs)) < 0;
+  }
+};
+
+} // namespace MOBase
+
+#endif // NATURALORDER_H
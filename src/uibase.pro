@@ -8,7 +8,7 @@ TARGET = uibase
 TEMPLATE = lib
 
 DEFINES += UIBASE_LIBRARY UIBASE_EXPORT
-CONFIG += dll c++11
+CONFIG += dll c++17
 
 greaterThan(QT_MAJOR_VERSION, 4) {
   QT += widgets qml declarative script quickwidgets winextras
@@ -36,6 +36,10 @@ SOURCES += \
     pluginsetting.cpp \
     diagnosisreport.cpp \
     directorytree.cpp \
+    directorytreediff.cpp \
+    directorytreemerger.cpp \
+    directorytreequery.cpp \
+    directorytreesnapshot.cpp \
     iplugininstaller.cpp \
     guessedvalue.cpp \
     json.cpp \
@@ -48,6 +52,7 @@ SOURCES += \
     executableinfo.cpp \
     delayedfilewriter.cpp \
     filenamestring.cpp \
+    naturalorder.cpp \
     registry.cpp \
     steamutility.cpp
 
@@ -65,7 +70,13 @@ HEADERS +=\
     dllimport.h \
     iplugininstaller.h \
     directorytree.h \
+    directorytreediff.h \
+    directorytreemerger.h \
+    directorytreequery.h \
+    directorytreesnapshot.h \
     mytree.h \
+    cowtree.h \
+    mytreewalk.h \
     iplugininstallersimple.h \
     iplugininstallercustom.h \
     installationtester.h \
@@ -80,6 +91,7 @@ HEADERS +=\
     guessedvalue.h \
     ipluginproxy.h \
     json.h \
+    jsonbinding.h \
     imodrepositorybridge.h \
     idownloadmanager.h \
     nxmurl.h \
@@ -96,6 +108,7 @@ HEADERS +=\
     iprofile.h \
     delayedfilewriter.h \
     filenamestring.h \
+    naturalorder.h \
     isavegame.h \
     isavegameinfowidget.h \
     filemapping.h \